@@ -0,0 +1,44 @@
+#version 460
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct TextureRegion {
+    vec2 uvOffset;
+    vec2 uvScale;
+    uint descriptorIndex;
+    float maxLod;
+};
+
+layout (set = 0, binding = 0, std430) readonly buffer Regions {
+    TextureRegion regions[];
+};
+layout (set = 0, binding = 1) uniform texture2D textures[];
+layout (set = 0, binding = 2) uniform sampler textureSampler;
+
+layout (push_constant) uniform PushConstants {
+    float time;
+    uint regionBase;
+    uint textureCount;
+    uint columns;
+} pushConstants;
+
+layout (location = 0) in vec2 uv;
+layout (location = 1) flat in uint region;
+
+layout (location = 0) out vec4 outColor;
+
+// Animated background and texture in a single write per pixel
+void main() {
+    TextureRegion textureRegion = regions[region];
+    // neighbouring instances sample different textures
+    sampler2D textureImage = sampler2D(textures[nonuniformEXT(textureRegion.descriptorIndex)], textureSampler);
+    vec2 atlasUv = textureRegion.uvOffset + textureRegion.uvScale * uv;
+    // atlas pages only hold the first few levels of a packed image, and filtering must not reach its neighbours
+    float lod = min(textureQueryLod(textureImage, atlasUv).x, textureRegion.maxLod);
+    vec2 halfTexel = 0.5 * exp2(ceil(lod)) / vec2(textureSize(textureImage, 0));
+    atlasUv = clamp(atlasUv, textureRegion.uvOffset + halfTexel,
+                    textureRegion.uvOffset + textureRegion.uvScale - halfTexel);
+
+    vec3 background = vec3(sin(pushConstants.time * 5.0) * 0.5 + 0.5, 0.0, 0.0);
+    vec4 color = textureLod(textureImage, atlasUv, lod);
+    outColor = vec4(mix(background, color.rgb, color.a), 1.0);
+}
@@ -0,0 +1,37 @@
+#version 460
+
+struct TextureRegion {
+    vec2 uvOffset;
+    vec2 uvScale;
+    uint descriptorIndex;
+    float maxLod;
+};
+
+layout (set = 0, binding = 0, std430) readonly buffer Regions {
+    TextureRegion regions[];
+};
+
+layout (push_constant) uniform PushConstants {
+    float time;
+    uint regionBase;
+    uint textureCount;
+    uint columns;
+} pushConstants;
+
+layout (location = 0) out vec2 outUv;
+layout (location = 1) flat out uint outRegion;
+
+// One quad per texture handle laid out in a grid, every texture in a single instanced draw without vertex buffers
+void main() {
+    outRegion = pushConstants.regionBase + gl_InstanceIndex;
+    outUv = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    // handles that are not resident collapse into a degenerate quad
+    if (regions[outRegion].descriptorIndex == 0xFFFFFFFFu) {
+        gl_Position = vec4(-2.0, -2.0, 0.0, 1.0);
+        return;
+    }
+    uint rows = (pushConstants.textureCount + pushConstants.columns - 1) / pushConstants.columns;
+    vec2 cell = vec2(gl_InstanceIndex % pushConstants.columns, gl_InstanceIndex / pushConstants.columns);
+    vec2 position = (cell + outUv) / vec2(pushConstants.columns, rows);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
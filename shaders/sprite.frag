@@ -0,0 +1,33 @@
+#version 460
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct TextureRegion {
+    vec2 uvOffset;
+    vec2 uvScale;
+    uint descriptorIndex;
+    float maxLod;
+};
+
+layout (set = 0, binding = 0, std430) readonly buffer Regions {
+    TextureRegion regions[];
+};
+layout (set = 0, binding = 1) uniform texture2D textures[];
+layout (set = 0, binding = 2) uniform sampler textureSampler;
+
+layout (location = 0) in vec2 uv;
+layout (location = 1) flat in uint region;
+layout (location = 2) flat in vec4 tint;
+
+layout (location = 0) out vec4 outColor;
+
+// Tinted texel, blended over what is already there
+void main() {
+    TextureRegion textureRegion = regions[region];
+    sampler2D textureImage = sampler2D(textures[nonuniformEXT(textureRegion.descriptorIndex)], textureSampler);
+    // same clamping as the composite shader, packed images must not bleed into their atlas neighbours
+    float lod = min(textureQueryLod(textureImage, uv).x, textureRegion.maxLod);
+    vec2 halfTexel = 0.5 * exp2(ceil(lod)) / vec2(textureSize(textureImage, 0));
+    vec2 clampedUv = clamp(uv, textureRegion.uvOffset + halfTexel,
+                           textureRegion.uvOffset + textureRegion.uvScale - halfTexel);
+    outColor = textureLod(textureImage, clampedUv, lod) * tint;
+}
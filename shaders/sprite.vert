@@ -0,0 +1,53 @@
+#version 460
+
+struct TextureRegion {
+    vec2 uvOffset;
+    vec2 uvScale;
+    uint descriptorIndex;
+    float maxLod;
+};
+
+struct Sprite {
+    vec2 position;
+    vec2 scale;
+    vec2 uvOffset;
+    vec2 uvScale;
+    uint textureHandle;
+    uint tint;
+};
+
+layout (set = 0, binding = 0, std430) readonly buffer Regions {
+    TextureRegion regions[];
+};
+
+layout (set = 1, binding = 0, std430) readonly buffer Sprites {
+    Sprite sprites[];
+};
+layout (set = 1, binding = 1, std430) readonly buffer VisibleSprites {
+    uint visibleSprites[];
+};
+
+layout (push_constant) uniform PushConstants {
+    vec2 viewportSize;
+    uint spriteBase;
+    uint spriteCount;
+    uint regionBase;
+    uint textureCount;
+} pushConstants;
+
+layout (location = 0) out vec2 outUv;
+layout (location = 1) flat out uint outRegion;
+layout (location = 2) flat out vec4 outTint;
+
+// One quad per visible sprite, positions are in pixels with y pointing down
+void main() {
+    Sprite sprite = sprites[pushConstants.spriteBase + visibleSprites[gl_InstanceIndex]];
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    vec2 pixel = sprite.position + (corner - 0.5) * sprite.scale;
+    gl_Position = vec4(pixel / pushConstants.viewportSize * 2.0 - 1.0, 0.0, 1.0);
+
+    outRegion = pushConstants.regionBase + sprite.textureHandle;
+    TextureRegion textureRegion = regions[outRegion];
+    outUv = textureRegion.uvOffset + textureRegion.uvScale * (sprite.uvOffset + sprite.uvScale * corner);
+    outTint = unpackUnorm4x8(sprite.tint);
+}
@@ -0,0 +1,1243 @@
+#pragma once
+
+#define VULKAN_HPP_ENABLE_DYNAMIC_LOADER_TOOL 0
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_vulkan.h>
+#include <print>
+#include <vulkan/vulkan_raii.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <exception>
+#include <thread>
+
+#define VMA_STATIC_VULKAN_FUNCTIONS 0
+#define VMA_DYNAMIC_VULKAN_FUNCTIONS 1
+#include <SDL3_image/SDL_image.h>
+
+#include "vk_mem_alloc.h"
+#include "memory.hpp"
+#include "device_selection.hpp"
+#include "frame_allocator.hpp"
+#include "image_layout.hpp"
+#include "texture_streamer.hpp"
+#include "texture_registry.hpp"
+#include "texture_reloader.hpp"
+#include "sprite_batch.hpp"
+#include "swapchain.hpp"
+#include "job_system.hpp"
+#include "render_graph.hpp"
+#include "pipeline.hpp"
+#include "trace.hpp"
+#include "post_process.hpp"
+#include "frame_capture.hpp"
+#include "profiler.hpp"
+#include "simulation.hpp"
+#include "image_decoder.hpp"
+
+class SDLException final : public std::runtime_error {
+public:
+    explicit SDLException(const std::string &message) : std::runtime_error(
+        std::format("{}: {}", message, SDL_GetError())) {}
+};
+
+constexpr auto VULKAN_VERSION{vk::makeApiVersion(0, 1, 4, 0)};
+
+// Command pool owned by one recording thread for one frame slot, reset in bulk when the slot is reused
+struct ThreadCommandPool {
+    vk::raii::CommandPool commandPool;
+    std::vector<vk::raii::CommandBuffer> secondaryCommandBuffers{};
+    uint32_t usedCount{};
+};
+
+struct Frame {
+    vk::raii::CommandPool commandPool;
+    vk::raii::CommandBuffer commandBuffer;
+    std::vector<ThreadCommandPool> threadCommandPools;
+    vk::raii::Semaphore imageAvailableSemaphore;
+    vk::raii::Semaphore renderFinishedSemaphore;
+    // GPU zones of the frame, null when the graphics queue has no timestamps; boxed since zones are counted atomically
+    std::unique_ptr<GpuZoneQueries> gpuZones;
+    // Frame timeline value signaled once the last submission of this frame slot has completed
+    uint64_t timelineValue{};
+    // CPU scratch of the frame's recording, rewound once the timeline value has been reached
+    HostArena hostArena{};
+};
+
+constexpr uint32_t DEFAULT_IN_FLIGHT_FRAME_COUNT{2};
+constexpr size_t INPUT_QUEUE_CAPACITY{1024};
+// Ticks the update thread runs back to back after a stall before it gives up catching up
+constexpr uint32_t MAX_CATCH_UP_TICKS{8};
+
+// Layout streamed textures are handed over in, ready to be sampled by fragment shaders
+constexpr ImageLayout STREAMED_TEXTURE_LAYOUT{
+    vk::ImageLayout::eShaderReadOnlyOptimal,
+    vk::PipelineStageFlagBits2::eFragmentShader,
+    vk::AccessFlagBits2::eShaderSampledRead,
+};
+
+// Image the sprites draw, streamed in the background from startup on
+constexpr auto SPRITE_IMAGE_FILENAME{ASSETS_PATH "images/screenshot.png"};
+
+struct AppOptions {
+    // Render into offscreen images instead of a window swapchain, using SDL's offscreen video driver
+    bool headless{false};
+    vk::Extent2D headlessExtent{800, 600};
+    uint32_t inFlightFrameCount{DEFAULT_IN_FLIGHT_FRAME_COUNT};
+    // Threads recording secondary command buffers next to the render thread, zero records everything on it
+    uint32_t recordWorkerCount{2};
+    std::string pipelineCacheFilename{"pipeline_cache.bin"};
+    // Capabilities of the devices seen before, so startup does not probe them again; empty disables it
+    std::string deviceCacheFilename{"device_cache.bin"};
+    // Device index or part of its name, used instead of the highest scoring device. Falls back to the VULKANIC_DEVICE
+    // environment variable when empty.
+    std::string device{};
+    // Chrome trace_event JSON of the startup phases, written once the first texture is ready; empty disables it
+    std::string startupTraceFilename{"startup_trace.json"};
+    // JSON report of memory budgets and allocations, written at exit and whenever F2 is pressed; empty disables it
+    std::string memoryReportFilename{"memory_report.json"};
+    PresentProfile presentProfile{PresentProfile::Throughput};
+    // Animated sprites of the first texture drawn over the grid every frame, for stress testing the sprite batch
+    uint32_t spriteCount{};
+    // Transient GPU memory per frame slot for uniforms and instance data, on top of what the sprites need
+    vk::DeviceSize transientBufferSize{4 << 20};
+    // Chrome trace of the most recent CPU and GPU zones, written at exit and whenever F3 is pressed; empty disables it
+    std::string profileTraceFilename{"profile_trace.json"};
+    // Collect vertex, fragment and compute invocation counts per render graph pass, where the device supports it
+    bool pipelineStatistics{false};
+    // Simulation ticks per second in Run(), the render thread draws at most one frame per tick
+    uint32_t updateRate{120};
+    // Color grade the frame on the async compute queue, where the device has one; frames are presented a frame later
+    bool postProcessing{false};
+    // Watch the images the app draws and swap in their new texels whenever one of them is saved
+    bool hotReload{false};
+    // Directory every rendered frame is written to, empty disables capturing
+    std::string captureDirectory{};
+    CaptureFormat captureFormat{CaptureFormat::Png};
+    // Threads encoding PNG captures, raw streams are always written by one
+    uint32_t captureWorkerCount{std::max(std::thread::hardware_concurrency() / 2, 1u)};
+    // Seconds Render() advances per frame instead of following the clock, so frames are reproducible; zero follows
+    // the clock
+    double fixedTimeStep{};
+};
+
+struct CompositePushConstants {
+    float time{};
+    // First region of the frame slot's copy, instance i draws texture handle i
+    uint32_t regionBase{};
+    uint32_t textureCount{};
+    uint32_t columns{};
+};
+
+// Timings of the most recent Render() call. gpuMilliseconds comes from timestamp queries and is only known once
+// the frame slot is reused, so it belongs to the frame rendered inFlightFrameCount calls earlier.
+struct FrameTimings {
+    // Time the host spent blocked waiting for the frame slot to come back from the GPU
+    double stallMilliseconds{};
+    double recordMilliseconds{};
+    // Part of recordMilliseconds spent writing sprites into the transient buffer
+    double spriteMilliseconds{};
+    double submitMilliseconds{};
+    std::optional<double> gpuMilliseconds{};
+};
+
+class App {
+    AppOptions options;
+    TraceRecorder startupTrace{};
+    bool startupTraceWritten{};
+    Profiler profiler{};
+
+    std::unique_ptr<SDL_Window, decltype(&SDL_DestroyWindow)> window{nullptr, SDL_DestroyWindow};
+    bool running{true};
+
+    // Run() forwards input from the event thread to the update thread, which publishes snapshots to the render thread
+    SpscQueue<InputEvent, INPUT_QUEUE_CAPACITY> inputEvents{};
+    SnapshotBuffer<FrameSnapshot> snapshots{};
+    std::exception_ptr renderError{};
+    // Snapshot of the frame being rendered, and which of its requests the render thread has handled already
+    FrameSnapshot snapshot{};
+    uint32_t handledResizeCount{};
+    uint32_t handledMemoryReportRequests{};
+    uint32_t handledProfileDumpRequests{};
+
+    std::optional<vk::raii::Context> context{};
+    std::optional<vk::raii::Instance> instance{};
+    std::optional<vk::raii::SurfaceKHR> surface{};
+    std::optional<vk::raii::PhysicalDevice> physicalDevice{};
+    std::string deviceName{};
+    uint32_t graphicsQueueFamilyIndex{};
+    uint32_t transferQueueFamilyIndex{};
+    vk::Extent3D transferGranularity{};
+    // The graphics family when there is no compute family apart from the transfer one
+    uint32_t computeQueueFamilyIndex{};
+    bool computeTimestampsSupported{};
+    double timestampPeriod{};
+    bool timestampsSupported{};
+    bool pipelineStatisticsEnabled{};
+    bool memoryBudgetSupported{};
+    std::optional<vk::raii::Device> device{};
+    std::optional<vk::raii::Queue> graphicsQueue{};
+    std::optional<vk::raii::Queue> transferQueue{};
+    std::optional<vk::raii::Queue> computeQueue{};
+    std::optional<Allocator> allocator{};
+    std::optional<TransientBuffer> transientBuffer{};
+    std::optional<ImageDecoder> decoder{};
+    std::optional<TextureStreamer> streamer{};
+    std::optional<TextureRegistry> textureRegistry{};
+    std::optional<TextureReloader> textureReloader{};
+
+    std::optional<PersistentPipelineCache> pipelineCache{};
+    std::optional<vk::raii::PipelineLayout> pipelineLayout{};
+    std::optional<vk::raii::Pipeline> compositePipeline{};
+    std::optional<SpriteBatch> spriteBatch{};
+    std::optional<PostProcessor> postProcessor{};
+    // Post pass result of the last submitted frame, which the next frame presents
+    std::optional<PostOutput> pendingPostOutput{};
+    std::optional<FrameCapture> frameCapture{};
+
+    std::optional<JobSystem> jobSystem{};
+    std::vector<Frame> frames{};
+    uint32_t frameIndex{};
+    // A single timeline for every frame slot, frame N signals value N
+    std::optional<vk::raii::Semaphore> frameTimeline{};
+    uint64_t frameCounter{};
+    FrameTimings frameTimings{};
+
+    std::optional<SwapchainManager> swapchain{};
+    // Extent of the swapchain or of the offscreen images when headless
+    vk::Extent2D swapchainExtent{};
+    vk::Format swapchainImageFormat{vk::Format::eB8G8R8A8Srgb};
+    uint32_t currentSwapchainImageIndex{};
+
+    // Headless render targets, one per in-flight frame
+    std::vector<AllocatedImage> offscreenImages{};
+    std::vector<vk::raii::ImageView> offscreenImageViews{};
+
+    // Handles reserved for requested images, they become resident once their uploads are done
+    std::vector<std::pair<StreamTicket, TextureHandle>> streamingTextures{};
+    TextureHandle spriteTexture{};
+    bool firstTextureReady{};
+    // Acquire halves of queue family ownership transfers the next recorded frame has to execute
+    std::vector<vk::ImageMemoryBarrier2> pendingAcquires{};
+    // Streamer timelines the next submission has to wait for before using freshly streamed textures
+    std::vector<vk::SemaphoreSubmitInfo> textureWaits{};
+
+    RenderGraph renderGraph{};
+    std::vector<vk::CommandBuffer> passCommandBuffers{};
+
+public:
+    explicit App(AppOptions const &options = {}) : options{options} {
+        if (options.inFlightFrameCount == 0)
+            throw std::invalid_argument("At least one frame has to be in flight");
+        if (options.updateRate == 0)
+            throw std::invalid_argument("The update rate has to be greater than zero");
+        startupTrace.SetThreadName("main");
+        profiler.SetThreadName("main");
+        if (options.headless && !SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen"))
+            throw SDLException("Failed to select offscreen video driver");
+        {
+            TraceScope const scope{&startupTrace, "SDL_Init"};
+            if (!SDL_Init(SDL_INIT_VIDEO))
+                throw SDLException("Failed to initialize SDL");
+        }
+
+        // Decoding only needs SDL_image, so it runs while the Vulkan instance and device are being created
+        decoder.emplace(2, &startupTrace);
+        streamingTextures.emplace_back(decoder->Request(SPRITE_IMAGE_FILENAME), TextureHandle{});
+
+        TraceScope const scope{&startupTrace, "LoadVulkan"};
+        if (!SDL_Vulkan_LoadLibrary(nullptr))
+            throw SDLException("Failed to load Vulkan library");
+        if (!options.headless) {
+            window.reset(SDL_CreateWindow("Codotaku", 800, 600,
+                                          SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_HIDDEN));
+            if (!window)
+                throw SDLException("Failed to create window");
+        }
+        auto vkGetInstanceProcAddr{reinterpret_cast<PFN_vkGetInstanceProcAddr>(SDL_Vulkan_GetVkGetInstanceProcAddr())};
+        context.emplace(vkGetInstanceProcAddr);
+        auto const vulkanVersion{context->enumerateInstanceVersion()};
+        std::println("Vulkan {}.{}", VK_API_VERSION_MAJOR(vulkanVersion), VK_API_VERSION_MINOR(vulkanVersion));
+
+        jobSystem.emplace(options.recordWorkerCount);
+    }
+
+    ~App() {
+        device->waitIdle();
+
+        pipelineCache->Save();
+        WriteStartupTrace();
+        WriteMemoryReport();
+        WriteProfileTrace();
+
+        // writes the frames still waiting to be encoded
+        frameCapture.reset();
+        textureReloader.reset();
+        streamer.reset();
+        postProcessor.reset();
+        spriteBatch.reset();
+        textureRegistry.reset();
+        transientBuffer.reset();
+        offscreenImageViews.clear();
+        offscreenImages.clear();
+
+        SDL_Quit();
+    }
+
+    void Init() {
+        InitInstance();
+        if (!options.headless)
+            InitSurface();
+        PickPhysicalDevice();
+        InitDevice();
+        InitAllocator();
+        InitTextureRegistry();
+        InitPipeline();
+        InitFrames();
+        if (options.headless)
+            InitOffscreenTargets();
+        else {
+            TraceScope const scope{&startupTrace, "CreateSwapchain"};
+            // captured frames are copied out of the swapchain images
+            vk::ImageUsageFlags swapchainUsage{};
+            if (!options.captureDirectory.empty()) {
+                if (!(physicalDevice->getSurfaceCapabilitiesKHR(**surface).supportedUsageFlags &
+                      vk::ImageUsageFlagBits::eTransferSrc))
+                    throw std::runtime_error("The surface does not allow copying from swapchain images");
+                swapchainUsage = vk::ImageUsageFlagBits::eTransferSrc;
+            }
+            swapchain.emplace(*physicalDevice, *device, *surface, swapchainImageFormat, options.presentProfile,
+                              swapchainUsage);
+            snapshot.windowExtent = GetWindowExtent();
+            if (swapchain->Update(snapshot.windowExtent, 0))
+                swapchainExtent = swapchain->GetExtent();
+        }
+        // enough readback buffers for the frames in flight and one being encoded by every worker
+        if (!options.captureDirectory.empty())
+            frameCapture.emplace(*device, *allocator, **frameTimeline, options.captureDirectory,
+                                 options.captureFormat, swapchainImageFormat,
+                                 options.inFlightFrameCount + options.captureWorkerCount + 1,
+                                 options.captureWorkerCount);
+
+        // The image requested in the constructor is uploaded in the background, frames render without it until then
+        streamer.emplace(*decoder, *physicalDevice, *device, *allocator, *graphicsQueue,
+                         graphicsQueueFamilyIndex, *transferQueue, transferQueueFamilyIndex, transferGranularity,
+                         STREAMED_TEXTURE_LAYOUT);
+        if (options.hotReload) {
+            textureReloader.emplace(*allocator);
+            textureReloader->Watch(SPRITE_IMAGE_FILENAME, spriteTexture);
+        }
+    }
+
+    // This thread only pumps SDL events, which has to happen on the thread that created the window. An update thread
+    // ticks the simulation at a fixed rate and a render thread draws its latest snapshot, so neither input nor the
+    // simulation stall while the render thread waits for the GPU or the compositor.
+    void Run() {
+        SDL_ShowWindow(window.get());
+        {
+            std::jthread const updateThread{
+                [this, windowExtent{GetWindowExtent()}](std::stop_token const &stopToken) {
+                    UpdateLoop(stopToken, windowExtent);
+                }
+            };
+            // declared last so it stops first, it may be waiting for the next snapshot
+            std::jthread const renderThread{[this](std::stop_token const &stopToken) { RenderLoop(stopToken); }};
+            for (SDL_Event event; running && SDL_WaitEvent(&event);)
+                HandleEvent(event);
+        }
+        if (renderError)
+            std::rethrow_exception(renderError);
+    }
+
+    // Renders a frame at the current time on the calling thread, for callers driving frames themselves instead of Run()
+    void Render() {
+        auto frameSnapshot{snapshot};
+        frameSnapshot.time = options.fixedTimeStep > 0.0
+                                 ? static_cast<double>(frameCounter) * options.fixedTimeStep
+                                 : static_cast<double>(SDL_GetTicks()) * 0.001;
+        RenderSnapshot(frameSnapshot);
+    }
+
+    // Blocks until every requested texture is resident, so the next frame draws all of them. Together with a fixed
+    // time step this makes the frames Render() draws the same on every run. Returns false if that took longer than
+    // timeout, images that fail to decode never become resident.
+    bool WaitForTextures(std::chrono::milliseconds const timeout) {
+        auto const deadline{std::chrono::steady_clock::now() + timeout};
+        PumpStreamer();
+        while (!streamingTextures.empty()) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            PumpStreamer();
+        }
+        return true;
+    }
+
+    // Waits for every in-flight frame and returns the GPU times that have not been reported by Render() yet
+    std::vector<double> Flush() {
+        device->waitIdle();
+        std::vector<double> gpuMilliseconds{};
+        for (uint32_t i = 0; i < frames.size(); i++) {
+            if (auto const milliseconds{ReadGpuZones(frames[i])})
+                gpuMilliseconds.push_back(*milliseconds);
+            if (postProcessor)
+                postProcessor->ReadZones(i, profiler);
+        }
+        profiler.Collect();
+        if (frameCapture)
+            frameCapture->Drain(frameTimeline->getCounterValue());
+        return gpuMilliseconds;
+    }
+
+    // Non-blocking check whether the next Render() call can start recording without waiting for the GPU
+    [[nodiscard]] bool IsNextFrameReady() const {
+        auto const timelineValue{frames[frameIndex].timelineValue};
+        return frameTimeline->getCounterValue() >= timelineValue &&
+            (!postProcessor || postProcessor->GetCompletedValue() >= timelineValue);
+    }
+
+    [[nodiscard]] FrameTimings const &GetFrameTimings() const { return frameTimings; }
+    [[nodiscard]] std::string const &GetDeviceName() const { return deviceName; }
+    [[nodiscard]] vk::Extent2D GetTargetExtent() const { return swapchainExtent; }
+    [[nodiscard]] std::vector<HeapBudget> GetHeapBudgets() const { return allocator->GetHeapBudgets(); }
+    // Rolling per-zone averages up to the frame before the last Render() call, or up to the last Flush()
+    [[nodiscard]] std::vector<ZoneSummary> GetProfileSummary() const { return profiler.GetSummary(); }
+
+    void WriteMemoryReport() const {
+        if (options.memoryReportFilename.empty())
+            return;
+        if (allocator->WriteReport(options.memoryReportFilename))
+            std::println("Wrote memory report to {}", options.memoryReportFilename);
+        else
+            std::println("Failed to write memory report to {}", options.memoryReportFilename);
+    }
+
+    void WriteProfileTrace() const {
+        if (options.profileTraceFilename.empty())
+            return;
+        if (profiler.WriteChromeTrace(options.profileTraceFilename))
+            std::println("Wrote profile trace to {}", options.profileTraceFilename);
+        else
+            std::println("Failed to write profile trace to {}", options.profileTraceFilename);
+    }
+
+private:
+    void UpdateLoop(std::stop_token const &stopToken, vk::Extent2D const windowExtent) {
+        profiler.SetThreadName("update");
+        Simulation simulation{windowExtent};
+        snapshots.GetBack() = simulation.GetState();
+        snapshots.Publish();
+
+        auto const tickSeconds{1.0 / options.updateRate};
+        auto const tickPeriod{
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>{tickSeconds})
+        };
+        auto nextTick{std::chrono::steady_clock::now() + tickPeriod};
+        while (!stopToken.stop_requested()) {
+            std::this_thread::sleep_until(nextTick);
+            {
+                ProfileZone const zone{&profiler, "Update"};
+                while (auto const event{inputEvents.TryPop()})
+                    simulation.Apply(*event);
+                simulation.Step(tickSeconds);
+                snapshots.GetBack() = simulation.GetState();
+                snapshots.Publish();
+            }
+            nextTick += tickPeriod;
+            // after a long stall such as a breakpoint the simulation resumes from now instead of racing to catch up
+            if (auto const now{std::chrono::steady_clock::now()}; now - nextTick > tickPeriod * MAX_CATCH_UP_TICKS)
+                nextTick = now;
+        }
+    }
+
+    void RenderLoop(std::stop_token const &stopToken) {
+        profiler.SetThreadName("render");
+        try {
+            uint64_t renderedCount{};
+            while (!stopToken.stop_requested()) {
+                // one frame per snapshot, drawn while the update thread already works on the next one
+                snapshots.WaitForPublish(renderedCount);
+                renderedCount = snapshots.GetPublishCount();
+                auto const &frameSnapshot{snapshots.Acquire()};
+                // nothing can be presented while minimized
+                if (!frameSnapshot.minimized)
+                    RenderSnapshot(frameSnapshot);
+            }
+        }
+        catch (...) {
+            // handed to Run() on the event thread, which has to be woken up to notice
+            renderError = std::current_exception();
+            SDL_Event quitEvent{};
+            quitEvent.type = SDL_EVENT_QUIT;
+            SDL_PushEvent(&quitEvent);
+        }
+    }
+
+    void RenderSnapshot(FrameSnapshot const &frameSnapshot) {
+        snapshot = frameSnapshot;
+        // a drag produces many resizes, they collapse into one recreation before the next acquire
+        if (std::exchange(handledResizeCount, snapshot.resizeCount) != snapshot.resizeCount && swapchain)
+            swapchain->Invalidate();
+        if (std::exchange(handledMemoryReportRequests, snapshot.memoryReportRequests) !=
+            snapshot.memoryReportRequests)
+            WriteMemoryReport();
+        if (std::exchange(handledProfileDumpRequests, snapshot.profileDumpRequests) != snapshot.profileDumpRequests) {
+            profiler.PrintSummary();
+            WriteProfileTrace();
+        }
+
+        // everything up to the previous frame goes into the rolling averages
+        profiler.Collect();
+        profiler.SetFrame(frameCounter + 1);
+        ProfileZone const zone{&profiler, "Render"};
+
+        auto &frame{frames[frameIndex]};
+        // streaming does not depend on the frame slot, get it done while the GPU may still be busy with it
+        {
+            ProfileZone const pumpZone{&profiler, "PumpStreamer"};
+            PumpStreamer();
+        }
+        if (!BeginFrame(frame))
+            return;
+
+        auto const recordStart{std::chrono::steady_clock::now()};
+        RecordCommandBuffer(frame, CurrentTargetImage());
+        auto const submitStart{std::chrono::steady_clock::now()};
+        SubmitCommandBuffer(frame);
+        auto const submitEnd{std::chrono::steady_clock::now()};
+
+        frameTimings.recordMilliseconds = std::chrono::duration<double, std::milli>(submitStart - recordStart).count();
+        frameTimings.submitMilliseconds = std::chrono::duration<double, std::milli>(submitEnd - submitStart).count();
+
+        EndFrame(frame);
+    }
+
+    void InitAllocator() {
+        TraceScope const scope{&startupTrace, "InitAllocator"};
+        allocator.emplace(*instance, *physicalDevice, *device, VULKAN_VERSION, memoryBudgetSupported);
+        // sized up front for the sprites, so steady-state frames never allocate GPU memory
+        transientBuffer.emplace(*physicalDevice, *allocator, options.inFlightFrameCount,
+                                options.transientBufferSize +
+                                static_cast<vk::DeviceSize>(options.spriteCount) * sizeof(Sprite));
+    }
+
+    void InitTextureRegistry() {
+        TraceScope const scope{&startupTrace, "InitTextureRegistry"};
+        textureRegistry.emplace(*physicalDevice, *device, *allocator, STREAMED_TEXTURE_LAYOUT,
+                                options.inFlightFrameCount);
+        // images requested before the device existed get their handles now
+        for (auto &[ticket, handle]: streamingTextures)
+            handle = textureRegistry->Reserve();
+        spriteTexture = streamingTextures.front().second;
+    }
+
+    void PumpStreamer() {
+        // before the streamed textures, a texture made resident in this frame must not be patched in it as well
+        if (textureReloader)
+            ApplyTextureChanges();
+
+        streamer->Pump();
+        for (auto &streamedTexture: streamer->TakeReady()) {
+            auto const streamingTexture{
+                std::ranges::find(streamingTextures, streamedTexture.ticket,
+                                  &std::pair<StreamTicket, TextureHandle>::first)
+            };
+            if (streamingTexture == streamingTextures.end())
+                continue;
+            if (streamedTexture.needsAcquire)
+                pendingAcquires.push_back(streamer->GetAcquireBarrier(streamedTexture));
+            textureWaits.emplace_back(streamedTexture.readySemaphore, streamedTexture.readyValue,
+                                      vk::PipelineStageFlagBits2::eAllCommands);
+            // a reloaded texture swaps in with this frame, the frames already submitted keep drawing the old one
+            if (textureRegistry->IsResident(streamingTexture->second))
+                textureRegistry->Replace(streamingTexture->second, std::move(streamedTexture), frameCounter);
+            else
+                textureRegistry->Insert(streamingTexture->second, std::move(streamedTexture));
+            streamingTextures.erase(streamingTexture);
+
+            if (!std::exchange(firstTextureReady, true)) {
+                startupTrace.Add("Startup until texture ready", startupTrace.GetOrigin(),
+                                 TraceRecorder::Clock::now());
+                WriteStartupTrace();
+            }
+        }
+    }
+
+    // Patches go straight to the registry, which copies them in this frame's upload pass. Everything else, any change
+    // to a texture with an upload still in flight and textures whose format cannot be blitted to regenerate the mip
+    // chain are streamed again and replace the texture once uploaded.
+    void ApplyTextureChanges() {
+        for (auto &change: textureReloader->TakeChanges()) {
+            auto const streaming{
+                std::ranges::contains(streamingTextures, change.handle, &std::pair<StreamTicket, TextureHandle>::second)
+            };
+            if (change.patch && !streaming && textureRegistry->IsPatchable(change.handle))
+                textureRegistry->Patch(change.handle, std::move(*change.patch));
+            else
+                streamingTextures.emplace_back(streamer->Request(change.filename), change.handle);
+        }
+    }
+
+    void WriteStartupTrace() {
+        if (startupTraceWritten || options.startupTraceFilename.empty())
+            return;
+        startupTraceWritten = true;
+        if (startupTrace.Write(options.startupTraceFilename))
+            std::println("Wrote startup trace to {}", options.startupTraceFilename);
+        else
+            std::println("Failed to write startup trace to {}", options.startupTraceFilename);
+    }
+
+    [[nodiscard]] vk::Image CurrentTargetImage() const {
+        return options.headless ? offscreenImages[frameIndex].Get() : swapchain->GetImage(currentSwapchainImageIndex);
+    }
+
+    [[nodiscard]] vk::ImageView CurrentTargetImageView() const {
+        return options.headless
+                   ? *offscreenImageViews[frameIndex]
+                   : swapchain->GetImageView(currentSwapchainImageIndex);
+    }
+
+    // Stage of the first write to the target, which is where the submission waits for the swapchain image
+    [[nodiscard]] vk::PipelineStageFlags2 GetTargetWriteStage() const {
+        return postProcessor
+                   ? vk::PipelineStageFlagBits2::eBlit | vk::PipelineStageFlagBits2::eClear
+                   : vk::PipelineStageFlagBits2::eColorAttachmentOutput;
+    }
+
+    [[nodiscard]] vk::Extent2D GetWindowExtent() const {
+        int width, height;
+        SDL_GetWindowSizeInPixels(window.get(), &width, &height);
+        return vk::Extent2D{static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+    }
+
+    // Records into the next free secondary command buffer of the calling thread's pool for this frame
+    template<typename Record>
+    static vk::CommandBuffer RecordSecondaryCommandBuffer(Frame &frame, uint32_t const threadIndex,
+                                                          vk::raii::Device const &device, Record const &record) {
+        auto &threadCommandPool{frame.threadCommandPools[threadIndex]};
+        if (threadCommandPool.usedCount == threadCommandPool.secondaryCommandBuffers.size()) {
+            vk::CommandBufferAllocateInfo commandBufferAllocateInfo{};
+            commandBufferAllocateInfo.commandPool = *threadCommandPool.commandPool;
+            commandBufferAllocateInfo.level = vk::CommandBufferLevel::eSecondary;
+            commandBufferAllocateInfo.commandBufferCount = 1;
+            threadCommandPool.secondaryCommandBuffers.push_back(
+                std::move(device.allocateCommandBuffers(commandBufferAllocateInfo).front()));
+        }
+        auto const &commandBuffer{threadCommandPool.secondaryCommandBuffers[threadCommandPool.usedCount++]};
+
+        vk::CommandBufferInheritanceInfo const inheritanceInfo{};
+        vk::CommandBufferBeginInfo beginInfo{};
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+        commandBuffer.begin(beginInfo);
+        record(commandBuffer);
+        commandBuffer.end();
+        return *commandBuffer;
+    }
+
+    void RecordCommandBuffer(Frame &frame, vk::Image const &swapchainImage) {
+        ProfileZone const zone{&profiler, "RecordCommandBuffer"};
+        auto const &commandBuffer{frame.commandBuffer};
+        vk::CommandBufferBeginInfo beginInfo{};
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        commandBuffer.begin(beginInfo);
+
+        // the frame zone comes first, its duration is what FrameTimings reports
+        uint32_t frameZone{};
+        if (frame.gpuZones) {
+            frame.gpuZones->Reset(commandBuffer, frameCounter + 1);
+            frameZone = frame.gpuZones->BeginZone(commandBuffer, "Frame", 0);
+        }
+
+        auto const t{snapshot.time};
+
+        // the slot's images follow the target's extent, the old ones live on until the next frame has presented them
+        if (postProcessor)
+            postProcessor->BeginFrame(frameIndex, swapchainExtent, frame.timelineValue + 1,
+                                      frameTimeline->getCounterValue());
+
+        renderGraph.Reset(frame.hostArena);
+        for (auto const &acquireBarrier: pendingAcquires)
+            renderGraph.AddExternalBarrier(acquireBarrier);
+        pendingAcquires.clear();
+
+        // swapchain images come from the acquire semaphore, which the submission waits for at the first write
+        auto const target{
+            renderGraph.ImportImage(swapchainImage,
+                                    ImageLayout{
+                                        vk::ImageLayout::eUndefined,
+                                        GetTargetWriteStage(),
+                                        vk::AccessFlagBits2::eNone,
+                                    })
+        };
+        if (!options.headless)
+            renderGraph.SetFinalUsage(target, ResourceUsage::Present);
+
+        // with post-processing the scene goes into the slot's scene image, the target gets the last frame's result
+        auto const scene{postProcessor ? postProcessor->ImportScene(renderGraph, frameIndex) : target};
+        // textures are sampled straight from the registry's images, only atlas pages written this frame are tracked
+        auto compositeAccesses{textureRegistry->AddUploadPass(renderGraph, frameCounter + 1)};
+        compositeAccesses.push_back({scene, ResourceUsage::ColorAttachment});
+        // the slot's previous submission has completed, so its copy of the regions can be rewritten
+        auto const regionBase{textureRegistry->UpdateRegions(frameIndex)};
+
+        auto const spriteStart{std::chrono::steady_clock::now()};
+        spriteBatch->Begin(frameIndex, *transientBuffer, options.spriteCount);
+        SubmitSprites(t);
+        frameTimings.spriteMilliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - spriteStart).count();
+        spriteBatch->AddCullPass(renderGraph, *textureRegistry, swapchainExtent, regionBase);
+
+        auto const sceneImageView{
+            postProcessor ? postProcessor->GetSceneImageView(frameIndex) : CurrentTargetImageView()
+        };
+        renderGraph.AddPass("composite", compositeAccesses,
+                            [&](vk::raii::CommandBuffer const &passCommandBuffer) {
+                                RecordComposite(passCommandBuffer, sceneImageView, regionBase, t);
+                            });
+        // last, so only the blit waits for the compute queue
+        if (postProcessor)
+            postProcessor->AddPresentPass(renderGraph, target, swapchainImage, swapchainExtent, pendingPostOutput);
+        // after everything that writes the target, read back once the frame has completed
+        if (frameCapture) {
+            ProfileZone const captureZone{&profiler, "Capture"};
+            frameCapture->AddCapturePass(renderGraph, target, swapchainImage, swapchainExtent, frameCounter + 1);
+        }
+
+        renderGraph.Compile();
+
+        // Passes are recorded into secondary command buffers in parallel, the graph stitches them together in order
+        auto const passes{renderGraph.GetPasses()};
+        passCommandBuffers.assign(passes.size(), {});
+        // one callable shared by every job, which only carries the pass index
+        auto const recordPass{
+            [&](uint32_t const passIndex, uint32_t const threadIndex) {
+                passCommandBuffers[passIndex] = RecordSecondaryCommandBuffer(
+                    frame, threadIndex, *device, [&](vk::raii::CommandBuffer const &passCommandBuffer) {
+                        RecordProfiledPass(frame, passCommandBuffer, passes[passIndex]);
+                    });
+            }
+        };
+        JobCounter recordCounter{};
+        for (uint32_t i = 0; i < passes.size(); i++)
+            jobSystem->Submit(recordCounter, JobSystem::Job{recordPass, i});
+        jobSystem->Wait(recordCounter);
+
+        renderGraph.Execute(commandBuffer, passCommandBuffers);
+
+        if (frame.gpuZones)
+            frame.gpuZones->EndZone(commandBuffer, frameZone);
+
+        commandBuffer.end();
+        transientBuffer->Flush();
+    }
+
+    // A CPU zone for the recording and a GPU zone with pipeline statistics for the execution of the pass
+    void RecordProfiledPass(Frame &frame, vk::raii::CommandBuffer const &commandBuffer,
+                            RenderGraph::Pass const &pass) {
+        ProfileZone const zone{&profiler, pass.name};
+        if (!frame.gpuZones) {
+            pass.record(commandBuffer);
+            return;
+        }
+        auto const gpuZone{frame.gpuZones->BeginZone(commandBuffer, pass.name, 1, true)};
+        pass.record(commandBuffer);
+        frame.gpuZones->EndZone(commandBuffer, gpuZone);
+    }
+
+    void RecordComposite(vk::raii::CommandBuffer const &commandBuffer, vk::ImageView const targetImageView,
+                         uint32_t const regionBase, double const time) const {
+        // grid cells of textures that are not resident yet show the background, which is the clear color
+        vk::RenderingAttachmentInfo colorAttachment{};
+        colorAttachment.imageView = targetImageView;
+        colorAttachment.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+        colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+        colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+        colorAttachment.clearValue = vk::ClearColorValue{
+            std::array{static_cast<float>(std::sin(time * 5.0) * 0.5 + 0.5), 0.0f, 0.0f, 1.0f}
+        };
+
+        vk::RenderingInfo renderingInfo{};
+        renderingInfo.renderArea = vk::Rect2D{{0, 0}, swapchainExtent};
+        renderingInfo.layerCount = 1;
+        renderingInfo.setColorAttachments(colorAttachment);
+        commandBuffer.beginRendering(renderingInfo);
+        commandBuffer.setViewport(0, vk::Viewport{
+                                      0.0f, 0.0f,
+                                      static_cast<float>(swapchainExtent.width),
+                                      static_cast<float>(swapchainExtent.height),
+                                      0.0f, 1.0f
+                                  });
+        commandBuffer.setScissor(0, vk::Rect2D{{0, 0}, swapchainExtent});
+
+        if (auto const textureCount{textureRegistry->GetHandleCount()}) {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, **compositePipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, **pipelineLayout, 0,
+                                             textureRegistry->GetDescriptorSet(), {});
+            CompositePushConstants const pushConstants{
+                static_cast<float>(time), regionBase, textureCount,
+                static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(textureCount))))
+            };
+            commandBuffer.pushConstants<CompositePushConstants>(
+                **pipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0,
+                pushConstants);
+            commandBuffer.draw(4, textureCount, 0, 0);
+        }
+        // sprites go over the grid, culled and counted by the sprite cull pass
+        spriteBatch->RecordDraw(commandBuffer, *textureRegistry, swapchainExtent, regionBase);
+
+        commandBuffer.endRendering();
+    }
+
+    // Sunflower spiral of spinning sprites filling the target, written in place into the frame's transient buffer
+    void SubmitSprites(double const time) {
+        auto const sprites{spriteBatch->Allocate(options.spriteCount)};
+        if (sprites.empty())
+            return;
+        auto const halfWidth{static_cast<float>(swapchainExtent.width) * 0.5f};
+        auto const halfHeight{static_cast<float>(swapchainExtent.height) * 0.5f};
+        // the spiral gathers around the pointer while it is inside the window
+        auto const centerX{snapshot.focus ? (*snapshot.focus)[0] : halfWidth};
+        auto const centerY{snapshot.focus ? (*snapshot.focus)[1] : halfHeight};
+        auto const maxRadius{std::max(halfWidth, halfHeight) * 1.5f};
+        auto const radiusScale{maxRadius / std::sqrt(static_cast<float>(sprites.size()))};
+        auto const size{std::max(2.0f, maxRadius * 3.0f / std::sqrt(static_cast<float>(sprites.size())))};
+        auto const rotation{static_cast<float>(time) * 0.25f};
+        constexpr auto goldenAngle{2.39996323f};
+        for (uint32_t i = 0; i < sprites.size(); i++) {
+            auto const angle{static_cast<float>(i) * goldenAngle + rotation};
+            auto const radius{std::sqrt(static_cast<float>(i) + 0.5f) * radiusScale};
+            sprites[i] = Sprite{
+                {centerX + radius * std::cos(angle), centerY + radius * std::sin(angle)},
+                {size, size},
+                {0.0f, 0.0f},
+                {1.0f, 1.0f},
+                spriteTexture,
+                0xFFFFFFFF,
+            };
+        }
+    }
+
+    // Only valid once the frame's timeline value has been reached, so the query results are available without waiting.
+    // Returns the GPU time of the whole frame.
+    std::optional<double> ReadGpuZones(Frame &frame) {
+        if (!frame.gpuZones)
+            return std::nullopt;
+        return frame.gpuZones->Read(profiler);
+    }
+
+    // Returns false when there is no swapchain image to render to, the frame is skipped then
+    bool BeginFrame(Frame &frame) {
+        ProfileZone const zone{&profiler, "BeginFrame"};
+        frameTimings.stallMilliseconds = 0.0;
+        if (!IsNextFrameReady()) {
+            ProfileZone const waitZone{&profiler, "Wait for frame slot"};
+            auto const stallStart{std::chrono::steady_clock::now()};
+            // the slot's scene image is free once the compute queue has read it too
+            std::array const semaphores{
+                **frameTimeline, postProcessor ? postProcessor->GetTimeline() : vk::Semaphore{}
+            };
+            std::array const values{frame.timelineValue, frame.timelineValue};
+            vk::SemaphoreWaitInfo waitInfo{};
+            waitInfo.semaphoreCount = postProcessor ? 2 : 1;
+            waitInfo.pSemaphores = semaphores.data();
+            waitInfo.pValues = values.data();
+            auto _ = device->waitSemaphores(waitInfo, UINT64_MAX);
+            frameTimings.stallMilliseconds = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - stallStart).count();
+        }
+        frameTimings.gpuMilliseconds = ReadGpuZones(frame);
+        if (postProcessor)
+            postProcessor->ReadZones(frameIndex, profiler);
+
+        // everything recorded for this slot has retired, recycle its command buffers in bulk
+        frame.commandPool.reset();
+        for (auto &threadCommandPool: frame.threadCommandPools) {
+            threadCommandPool.commandPool.reset();
+            threadCommandPool.usedCount = 0;
+        }
+        textureRegistry->CollectRetired(frameTimeline->getCounterValue());
+        // readbacks of this and any earlier completed frame go to the encoders
+        if (frameCapture)
+            frameCapture->Drain(frameTimeline->getCounterValue());
+        frame.hostArena.Reset();
+        transientBuffer->Reset(frameIndex);
+
+        if (options.headless)
+            return true;
+
+        swapchain->CollectRetired(frameTimeline->getCounterValue());
+        // however many resizes came in, the swapchain is recreated once here; an out of date acquire gets one retry
+        ProfileZone const acquireZone{&profiler, "Acquire"};
+        for (auto attempt{0}; attempt < 2; attempt++) {
+            if (!swapchain->Update(snapshot.windowExtent, frameCounter))
+                return false;
+            swapchainExtent = swapchain->GetExtent();
+            if (auto const imageIndex{swapchain->Acquire(*frame.imageAvailableSemaphore)}) {
+                currentSwapchainImageIndex = *imageIndex;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void EndFrame(Frame const &frame) {
+        if (!options.headless) {
+            ProfileZone const zone{&profiler, "Present"};
+            swapchain->Present(*graphicsQueue, currentSwapchainImageIndex, *frame.renderFinishedSemaphore);
+        }
+
+        frameIndex = (frameIndex + 1) % options.inFlightFrameCount;
+    }
+
+    void SubmitCommandBuffer(Frame &frame) {
+        ProfileZone const zone{&profiler, "Submit"};
+        vk::CommandBufferSubmitInfo const commandBufferSubmitInfo{*frame.commandBuffer};
+        std::pmr::vector<vk::SemaphoreSubmitInfo> waitSemaphoreInfos{&frame.hostArena};
+        frame.timelineValue = ++frameCounter;
+        std::pmr::vector<vk::SemaphoreSubmitInfo> signalSemaphoreInfos{&frame.hostArena};
+        signalSemaphoreInfos.emplace_back(**frameTimeline, frame.timelineValue,
+                                          vk::PipelineStageFlagBits2::eAllCommands);
+        if (!options.headless) {
+            waitSemaphoreInfos.emplace_back(*frame.imageAvailableSemaphore, 0, GetTargetWriteStage());
+            signalSemaphoreInfos.emplace_back(*frame.renderFinishedSemaphore, 0,
+                                              vk::PipelineStageFlagBits2::eAllCommands);
+        }
+        // first use of freshly streamed textures
+        waitSemaphoreInfos.insert(waitSemaphoreInfos.end(), textureWaits.begin(), textureWaits.end());
+        textureWaits.clear();
+        // the previous frame's post result, blitted at the end of this one
+        if (pendingPostOutput)
+            waitSemaphoreInfos.push_back(postProcessor->GetBlitWait(*pendingPostOutput));
+
+        vk::SubmitInfo2 submitInfo{};
+        submitInfo.setCommandBufferInfos(commandBufferSubmitInfo);
+        submitInfo.setWaitSemaphoreInfos(waitSemaphoreInfos);
+        submitInfo.setSignalSemaphoreInfos(signalSemaphoreInfos);
+        if (frame.gpuZones)
+            frame.gpuZones->MarkSubmitted(profiler.Now());
+        graphicsQueue->submit2(submitInfo);
+
+        if (postProcessor)
+            pendingPostOutput = postProcessor->Submit(frameIndex, **frameTimeline, frame.timelineValue,
+                                                      profiler.Now());
+    }
+
+    // Translates SDL events for the update thread, everything else happens there or on the render thread
+    void HandleEvent(SDL_Event const &event) {
+        switch (event.type) {
+            case SDL_EVENT_QUIT:
+                running = false;
+                break;
+            case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+                PushInput({
+                    InputEvent::Type::Resize, static_cast<float>(event.window.data1),
+                    static_cast<float>(event.window.data2)
+                });
+                break;
+            case SDL_EVENT_WINDOW_MINIMIZED:
+                PushInput({InputEvent::Type::Minimize});
+                break;
+            case SDL_EVENT_WINDOW_RESTORED:
+            case SDL_EVENT_WINDOW_MAXIMIZED:
+                PushInput({InputEvent::Type::Restore});
+                break;
+            case SDL_EVENT_MOUSE_MOTION: {
+                // motion comes in window coordinates, the focus is in pixels like the swapchain
+                auto const density{SDL_GetWindowPixelDensity(window.get())};
+                PushInput({InputEvent::Type::PointerMove, event.motion.x * density, event.motion.y * density});
+                break;
+            }
+            case SDL_EVENT_WINDOW_MOUSE_LEAVE:
+                PushInput({InputEvent::Type::PointerLeave});
+                break;
+            case SDL_EVENT_KEY_DOWN:
+                if (event.key.key == SDLK_F2 && !event.key.repeat)
+                    PushInput({InputEvent::Type::MemoryReport});
+                if (event.key.key == SDLK_F3 && !event.key.repeat)
+                    PushInput({InputEvent::Type::ProfileDump});
+                break;
+            default: break;
+        }
+    }
+
+    void PushInput(InputEvent const &event) {
+        // the update thread drains the queue every tick, it is only ever full for a moment
+        while (!inputEvents.TryPush(event))
+            std::this_thread::yield();
+    }
+
+    vk::raii::ImageView CreateTargetImageView(vk::Image const image) const {
+        vk::ImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.image = image;
+        imageViewCreateInfo.viewType = vk::ImageViewType::e2D;
+        imageViewCreateInfo.format = swapchainImageFormat;
+        imageViewCreateInfo.subresourceRange = vk::ImageSubresourceRange{
+            vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1
+        };
+        return vk::raii::ImageView{*device, imageViewCreateInfo};
+    }
+
+    void InitOffscreenTargets() {
+        TraceScope const scope{&startupTrace, "InitOffscreenTargets"};
+        swapchainExtent = options.headlessExtent;
+
+        vk::ImageCreateInfo imageCreateInfo{};
+        imageCreateInfo.imageType = vk::ImageType::e2D;
+        imageCreateInfo.format = swapchainImageFormat;
+        imageCreateInfo.extent = vk::Extent3D{swapchainExtent.width, swapchainExtent.height, 1};
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+        imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+        imageCreateInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst |
+            vk::ImageUsageFlagBits::eTransferSrc;
+        imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        for (size_t i = 0; i < options.inFlightFrameCount; i++) {
+            offscreenImages.push_back(
+                allocator->CreateImage(imageCreateInfo, allocationCreateInfo, AllocationCategory::RenderTarget));
+            offscreenImageViews.push_back(CreateTargetImageView(offscreenImages.back().Get()));
+        }
+    }
+
+    void InitFrames() {
+        TraceScope const scope{&startupTrace, "InitFrames"};
+        vk::CommandPoolCreateInfo commandPoolCreateInfo{};
+        commandPoolCreateInfo.queueFamilyIndex = graphicsQueueFamilyIndex;
+        commandPoolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+        frames.reserve(options.inFlightFrameCount);
+        for (size_t i = 0; i < options.inFlightFrameCount; i++) {
+            vk::raii::CommandPool commandPool{*device, commandPoolCreateInfo};
+
+            vk::CommandBufferAllocateInfo commandBufferAllocateInfo{};
+            commandBufferAllocateInfo.commandPool = *commandPool;
+            commandBufferAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+            commandBufferAllocateInfo.commandBufferCount = 1;
+            auto commandBuffer{std::move(device->allocateCommandBuffers(commandBufferAllocateInfo).front())};
+
+            std::vector<ThreadCommandPool> threadCommandPools{};
+            for (uint32_t threadIndex = 0; threadIndex < jobSystem->GetThreadCount(); threadIndex++)
+                threadCommandPools.push_back(ThreadCommandPool{vk::raii::CommandPool{*device, commandPoolCreateInfo}});
+
+            frames.emplace_back(
+                std::move(commandPool),
+                std::move(commandBuffer),
+                std::move(threadCommandPools),
+                vk::raii::Semaphore{*device, vk::SemaphoreCreateInfo{}},
+                vk::raii::Semaphore{*device, vk::SemaphoreCreateInfo{}},
+                timestampsSupported
+                    ? std::make_unique<GpuZoneQueries>(*device, timestampPeriod, pipelineStatisticsEnabled)
+                    : nullptr
+            );
+        }
+
+        vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> semaphoreCreateInfo{
+            {}, vk::SemaphoreTypeCreateInfo{vk::SemaphoreType::eTimeline, 0}
+        };
+        frameTimeline.emplace(*device, semaphoreCreateInfo.get<vk::SemaphoreCreateInfo>());
+    }
+
+    void InitPipeline() {
+        TraceScope const scope{&startupTrace, "InitPipeline"};
+        pipelineCache.emplace(*physicalDevice, *device, options.pipelineCacheFilename);
+
+        vk::PushConstantRange const pushConstantRange{
+            vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(CompositePushConstants)
+        };
+        vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.setSetLayouts(*textureRegistry->GetDescriptorSetLayout());
+        pipelineLayoutCreateInfo.setPushConstantRanges(pushConstantRange);
+        pipelineLayout.emplace(*device, pipelineLayoutCreateInfo);
+
+        auto const vertexShaderModule{LoadShaderModule(*device, SHADERS_PATH "composite.vert.spv")};
+        auto const fragmentShaderModule{LoadShaderModule(*device, SHADERS_PATH "composite.frag.spv")};
+        std::array const shaderStages{
+            vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eVertex, *vertexShaderModule, "main"},
+            vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eFragment, *fragmentShaderModule, "main"},
+        };
+
+        vk::PipelineVertexInputStateCreateInfo const vertexInputState{};
+        vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState{};
+        inputAssemblyState.topology = vk::PrimitiveTopology::eTriangleStrip;
+        vk::PipelineViewportStateCreateInfo viewportState{};
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+        vk::PipelineRasterizationStateCreateInfo rasterizationState{};
+        rasterizationState.polygonMode = vk::PolygonMode::eFill;
+        rasterizationState.cullMode = vk::CullModeFlagBits::eNone;
+        rasterizationState.lineWidth = 1.0f;
+        vk::PipelineMultisampleStateCreateInfo multisampleState{};
+        multisampleState.rasterizationSamples = vk::SampleCountFlagBits::e1;
+        vk::PipelineColorBlendAttachmentState colorBlendAttachment{};
+        colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        vk::PipelineColorBlendStateCreateInfo colorBlendState{};
+        colorBlendState.setAttachments(colorBlendAttachment);
+        std::array const dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+        vk::PipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.setDynamicStates(dynamicStates);
+
+        vk::GraphicsPipelineCreateInfo pipelineCreateInfo{};
+        pipelineCreateInfo.setStages(shaderStages);
+        pipelineCreateInfo.pVertexInputState = &vertexInputState;
+        pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+        pipelineCreateInfo.pViewportState = &viewportState;
+        pipelineCreateInfo.pRasterizationState = &rasterizationState;
+        pipelineCreateInfo.pMultisampleState = &multisampleState;
+        pipelineCreateInfo.pColorBlendState = &colorBlendState;
+        pipelineCreateInfo.pDynamicState = &dynamicState;
+        pipelineCreateInfo.layout = **pipelineLayout;
+
+        vk::PipelineRenderingCreateInfo renderingCreateInfo{};
+        renderingCreateInfo.setColorAttachmentFormats(swapchainImageFormat);
+
+        vk::StructureChain chain{pipelineCreateInfo, renderingCreateInfo};
+        TraceScope const createScope{
+            &startupTrace, pipelineCache->IsWarm() ? "CreateCompositePipeline (warm)" : "CreateCompositePipeline (cold)"
+        };
+        compositePipeline.emplace(*device, pipelineCache->Get(), chain.get<vk::GraphicsPipelineCreateInfo>());
+        spriteBatch.emplace(*device, *allocator, *pipelineCache, *textureRegistry, *transientBuffer,
+                            swapchainImageFormat, options.inFlightFrameCount,
+                            std::max(options.spriteCount, DEFAULT_SPRITE_CAPACITY));
+        if (options.postProcessing) {
+            postProcessor.emplace(*device, *allocator, *pipelineCache, swapchainImageFormat,
+                                  options.inFlightFrameCount, graphicsQueueFamilyIndex, *computeQueue,
+                                  computeQueueFamilyIndex, computeTimestampsSupported, timestampPeriod);
+            std::println("Post-processing on the {} queue", postProcessor->IsAsync() ? "async compute" : "graphics");
+        }
+    }
+
+    void InitDevice() {
+        TraceScope const scope{&startupTrace, "InitDevice"};
+        std::array queuePriorities{1.0f};
+        std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos{};
+        for (auto const queueFamilyIndex: {
+                 graphicsQueueFamilyIndex, transferQueueFamilyIndex, computeQueueFamilyIndex
+             }) {
+            if (std::ranges::contains(queueCreateInfos, queueFamilyIndex, &vk::DeviceQueueCreateInfo::queueFamilyIndex))
+                continue;
+            vk::DeviceQueueCreateInfo queueCreateInfo{};
+            queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+            queueCreateInfo.setQueuePriorities(queuePriorities);
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+        // Block compressed textures are streamed as they are wherever the device can sample them
+        auto const supportedFeatures{physicalDevice->getFeatures()};
+        vk::PhysicalDeviceFeatures features{};
+        features.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        features.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+        pipelineStatisticsEnabled = options.pipelineStatistics && supportedFeatures.pipelineStatisticsQuery;
+        features.pipelineStatisticsQuery = pipelineStatisticsEnabled;
+
+        vk::DeviceCreateInfo deviceCreateInfo{};
+        deviceCreateInfo.setQueueCreateInfos(queueCreateInfos);
+        deviceCreateInfo.pEnabledFeatures = &features;
+        std::vector<const char *> enabledExtensions{};
+        if (!options.headless)
+            enabledExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        // Lets the allocator read per-heap budgets from the driver instead of estimating them
+        if (memoryBudgetSupported)
+            enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        deviceCreateInfo.setPEnabledExtensionNames(enabledExtensions);
+
+        vk::PhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.timelineSemaphore = true;
+        // Bindless textures: one runtime sized array, written while frames using other elements are in flight
+        vulkan12Features.descriptorIndexing = true;
+        vulkan12Features.runtimeDescriptorArray = true;
+        vulkan12Features.descriptorBindingPartiallyBound = true;
+        vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = true;
+        vulkan12Features.shaderSampledImageArrayNonUniformIndexing = true;
+
+        vk::PhysicalDeviceVulkan13Features vulkan13Features{};
+        vulkan13Features.synchronization2 = true;
+        vulkan13Features.dynamicRendering = true;
+
+        vk::StructureChain chain{
+            deviceCreateInfo, vulkan12Features, vulkan13Features
+        };
+
+        device.emplace(*physicalDevice, chain.get<vk::DeviceCreateInfo>());
+
+        graphicsQueue.emplace(*device, graphicsQueueFamilyIndex, 0);
+        // without dedicated families these are the graphics queue, which is only ever submitted to from this thread
+        transferQueue.emplace(*device, transferQueueFamilyIndex, 0);
+        computeQueue.emplace(*device, computeQueueFamilyIndex, 0);
+    }
+
+    void PickPhysicalDevice() {
+        TraceScope const scope{&startupTrace, "PickPhysicalDevice"};
+        auto const physicalDevices{instance->enumeratePhysicalDevices()};
+        if (physicalDevices.empty())
+            throw std::runtime_error("No Vulkan devices found");
+
+        std::string_view overrideDevice{options.device};
+        if (auto const environmentDevice{std::getenv("VULKANIC_DEVICE")}; overrideDevice.empty() && environmentDevice)
+            overrideDevice = environmentDevice;
+        DeviceCapabilityCache cache{options.deviceCacheFilename};
+        auto const selection{
+            SelectPhysicalDevice(physicalDevices, surface ? **surface : vk::SurfaceKHR{}, cache, overrideDevice)
+        };
+        auto const &capabilities{selection.capabilities};
+        physicalDevice.emplace(*instance, *physicalDevices[selection.index]);
+        auto const properties{physicalDevice->getProperties()};
+        deviceName = std::string(properties.deviceName.data(), std::strlen(properties.deviceName));
+        std::println("Using {}", deviceName);
+        graphicsQueueFamilyIndex = selection.graphicsQueueFamilyIndex;
+
+        // without a dedicated family streaming shares the graphics queue
+        if (capabilities.transferQueueFamilyIndex != NO_QUEUE_FAMILY) {
+            transferQueueFamilyIndex = capabilities.transferQueueFamilyIndex;
+            transferGranularity = capabilities.transferGranularity;
+        } else {
+            transferQueueFamilyIndex = graphicsQueueFamilyIndex;
+            transferGranularity = vk::Extent3D{1, 1, 1};
+        }
+
+        // the streamer owns the transfer queue, so a compute family that is also the transfer family is not used
+        computeQueueFamilyIndex = capabilities.computeQueueFamilyIndex != NO_QUEUE_FAMILY &&
+                                  capabilities.computeQueueFamilyIndex != transferQueueFamilyIndex
+                                      ? capabilities.computeQueueFamilyIndex
+                                      : graphicsQueueFamilyIndex;
+
+        timestampPeriod = properties.limits.timestampPeriod;
+        timestampsSupported = (capabilities.timestampQueueFamilies & 1u << graphicsQueueFamilyIndex) != 0;
+        computeTimestampsSupported = (capabilities.timestampQueueFamilies & 1u << computeQueueFamilyIndex) != 0;
+        memoryBudgetSupported = capabilities.memoryBudget;
+    }
+
+    void InitInstance() {
+        TraceScope const scope{&startupTrace, "InitInstance"};
+        vk::ApplicationInfo applicationInfo{};
+        applicationInfo.apiVersion = VULKAN_VERSION;
+
+        vk::InstanceCreateInfo instanceCreateInfo{};
+        instanceCreateInfo.pApplicationInfo = &applicationInfo;
+        // Headless rendering needs no surface extensions
+        if (!options.headless) {
+            uint32_t extensionCount;
+            instanceCreateInfo.ppEnabledExtensionNames = SDL_Vulkan_GetInstanceExtensions(&extensionCount);
+            instanceCreateInfo.enabledExtensionCount = extensionCount;
+        }
+
+        instance.emplace(*context, instanceCreateInfo);
+    }
+
+    void InitSurface() {
+        TraceScope const scope{&startupTrace, "InitSurface"};
+        VkSurfaceKHR raw_surface;
+        if (!SDL_Vulkan_CreateSurface(window.get(), **instance, nullptr, &raw_surface))
+            throw SDLException("Failed to create Vulkan surface");
+        surface.emplace(*instance, raw_surface);
+    }
+};
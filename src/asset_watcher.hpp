@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <SDL3/SDL.h>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Editors save in several writes or write a temporary file and rename it, changes are reported once no further event
+// came in for this long
+constexpr std::chrono::milliseconds ASSET_CHANGE_SETTLE_TIME{50};
+
+// Reports files that were rewritten. On Linux the parent directories are watched with inotify, so saves that replace
+// the file by renaming a temporary one over it are seen too; elsewhere modification times are polled. Not thread-safe,
+// meant to be owned by the one thread that waits on it.
+class AssetWatcher {
+    std::vector<std::filesystem::path> files{};
+#if defined(__linux__)
+    int fd{-1};
+    // Watch descriptors of the parent directories, inotify hands out the same one for a directory watched twice
+    std::unordered_map<int, std::filesystem::path> directories{};
+#else
+    std::vector<std::filesystem::file_time_type> writeTimes{};
+#endif
+
+public:
+    AssetWatcher() {
+#if defined(__linux__)
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error(std::format("Failed to initialize inotify: {}", std::strerror(errno)));
+#endif
+    }
+
+    ~AssetWatcher() {
+#if defined(__linux__)
+        close(fd);
+#endif
+    }
+
+    AssetWatcher(AssetWatcher const &) = delete;
+    AssetWatcher &operator=(AssetWatcher const &) = delete;
+
+    // The file does not have to exist yet, failures to watch it are logged and leave it unwatched
+    void Watch(std::filesystem::path const &filename) {
+        auto const path{std::filesystem::absolute(filename).lexically_normal()};
+        if (std::ranges::contains(files, path))
+            return;
+#if defined(__linux__)
+        auto const directory{path.parent_path()};
+        auto const watchDescriptor{inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO)};
+        if (watchDescriptor == -1) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to watch %s: %s", directory.c_str(),
+                         std::strerror(errno));
+            return;
+        }
+        directories[watchDescriptor] = directory;
+#else
+        std::error_code error{};
+        writeTimes.push_back(std::filesystem::last_write_time(path, error));
+#endif
+        files.push_back(path);
+    }
+
+    // Blocks for at most timeout and returns the watched files that changed, each once
+    std::vector<std::filesystem::path> Wait(std::chrono::milliseconds const timeout) {
+        std::vector<std::filesystem::path> changed{};
+#if defined(__linux__)
+        auto waitTime{timeout};
+        pollfd pollDescriptor{fd, POLLIN, 0};
+        while (poll(&pollDescriptor, 1, static_cast<int>(waitTime.count())) > 0) {
+            ReadEvents(changed);
+            waitTime = ASSET_CHANGE_SETTLE_TIME;
+        }
+#else
+        std::this_thread::sleep_for(timeout);
+        for (size_t i = 0; i < files.size(); i++) {
+            std::error_code error{};
+            auto const writeTime{std::filesystem::last_write_time(files[i], error)};
+            if (error || writeTime == writeTimes[i])
+                continue;
+            writeTimes[i] = writeTime;
+            changed.push_back(files[i]);
+        }
+#endif
+        return changed;
+    }
+
+private:
+#if defined(__linux__)
+    void ReadEvents(std::vector<std::filesystem::path> &changed) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t size;
+        while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t offset = 0; offset < size;) {
+                auto const event{reinterpret_cast<inotify_event const *>(buffer + offset)};
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                auto const directory{directories.find(event->wd)};
+                if (event->len == 0 || directory == directories.end())
+                    continue;
+                auto const path{directory->second / event->name};
+                if (std::ranges::contains(files, path) && !std::ranges::contains(changed, path))
+                    changed.push_back(path);
+            }
+        }
+    }
+#endif
+};
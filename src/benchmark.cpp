@@ -0,0 +1,257 @@
+#include "app.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string_view>
+
+// Calls to operator new from any thread, the array and nothrow forms forward to it. Replacing it lets the benchmark
+// show that steady-state frames allocate nothing on the heap; over-aligned allocations are not counted.
+static std::atomic<uint64_t> heapAllocationCount{};
+
+void *operator new(std::size_t const size) {
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto const pointer{std::malloc(size == 0 ? 1 : size)})
+        return pointer;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *const pointer) noexcept { std::free(pointer); }
+void operator delete(void *const pointer, std::size_t) noexcept { std::free(pointer); }
+
+struct BenchmarkOptions {
+    uint32_t warmupFrameCount{60};
+    uint32_t frameCount{1000};
+    vk::Extent2D extent{1920, 1080};
+    uint32_t inFlightFrameCount{DEFAULT_IN_FLIGHT_FRAME_COUNT};
+    uint32_t recordWorkerCount{AppOptions{}.recordWorkerCount};
+    uint32_t spriteCount{};
+    bool pipelineStatistics{};
+    bool postProcessing{};
+    std::string device{};
+    std::string outputFilename{"benchmark.json"};
+    // Every frame, warmup included, is written here and drawn at a fixed time step once the textures are resident
+    std::string captureDirectory{};
+    CaptureFormat captureFormat{CaptureFormat::Png};
+};
+
+// Simulated seconds per frame while capturing, the same on every run so captures can be compared against golden images
+constexpr double CAPTURE_TIME_STEP{1.0 / 60.0};
+// How long a capture waits for the textures to become resident before giving up
+constexpr std::chrono::seconds CAPTURE_TEXTURE_TIMEOUT{10};
+
+struct Summary {
+    double min{};
+    double median{};
+    double p99{};
+};
+
+static Summary Summarize(std::vector<double> samples) {
+    if (samples.empty())
+        return {};
+    std::ranges::sort(samples);
+    // nearest-rank percentile
+    auto const percentile{
+        [&](double const p) {
+            auto const rank{static_cast<size_t>(std::ceil(p * static_cast<double>(samples.size())))};
+            return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+        }
+    };
+    return Summary{samples.front(), percentile(0.5), percentile(0.99)};
+}
+
+static std::string ToJson(Summary const &summary, size_t const sampleCount) {
+    return std::format(R"({{"samples": {}, "min": {:.6f}, "median": {:.6f}, "p99": {:.6f}}})",
+                       sampleCount, summary.min, summary.median, summary.p99);
+}
+
+static uint32_t ParseUnsigned(std::string_view const argument, std::string_view const value) {
+    uint32_t result{};
+    auto const [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc{} || end != value.data() + value.size())
+        throw std::runtime_error(std::format("Invalid value for {}: {}", argument, value));
+    return result;
+}
+
+static BenchmarkOptions ParseArguments(int const argc, char **argv) {
+    BenchmarkOptions options{};
+    for (int i = 1; i < argc; i++) {
+        std::string_view const argument{argv[i]};
+        // flags, like in the app
+        if (argument == "--pipeline-statistics") {
+            options.pipelineStatistics = true;
+            continue;
+        }
+        if (argument == "--post-processing") {
+            options.postProcessing = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::runtime_error(std::format("Missing value for {}", argument));
+        std::string_view const value{argv[++i]};
+        if (argument == "--frames")
+            options.frameCount = ParseUnsigned(argument, value);
+        else if (argument == "--warmup")
+            options.warmupFrameCount = ParseUnsigned(argument, value);
+        else if (argument == "--width")
+            options.extent.width = ParseUnsigned(argument, value);
+        else if (argument == "--height")
+            options.extent.height = ParseUnsigned(argument, value);
+        else if (argument == "--frames-in-flight")
+            options.inFlightFrameCount = ParseUnsigned(argument, value);
+        else if (argument == "--record-workers")
+            options.recordWorkerCount = ParseUnsigned(argument, value);
+        else if (argument == "--sprites")
+            options.spriteCount = ParseUnsigned(argument, value);
+        else if (argument == "--device")
+            options.device = value;
+        else if (argument == "--output")
+            options.outputFilename = value;
+        else if (argument == "--capture")
+            options.captureDirectory = value;
+        else if (argument == "--capture-format") {
+            if (value == "png")
+                options.captureFormat = CaptureFormat::Png;
+            else if (value == "raw")
+                options.captureFormat = CaptureFormat::Raw;
+            else
+                throw std::runtime_error(std::format("Invalid value for {}: {}", argument, value));
+        }
+        else
+            throw std::runtime_error(std::format("Unknown argument: {}", argument));
+    }
+    if (options.frameCount == 0)
+        throw std::runtime_error("--frames must be greater than zero");
+    if (options.inFlightFrameCount == 0)
+        throw std::runtime_error("--frames-in-flight must be greater than zero");
+    return options;
+}
+
+int main(int argc, char **argv) {
+    try {
+        auto const options{ParseArguments(argc, argv)};
+
+        App app{
+            AppOptions{
+                .headless = true,
+                .headlessExtent = options.extent,
+                .inFlightFrameCount = options.inFlightFrameCount,
+                .recordWorkerCount = options.recordWorkerCount,
+                .device = options.device,
+                .spriteCount = options.spriteCount,
+                .pipelineStatistics = options.pipelineStatistics,
+                .postProcessing = options.postProcessing,
+                .captureDirectory = options.captureDirectory,
+                .captureFormat = options.captureFormat,
+                .fixedTimeStep = options.captureDirectory.empty() ? 0.0 : CAPTURE_TIME_STEP,
+            }
+        };
+        app.Init();
+        if (!options.captureDirectory.empty() && !app.WaitForTextures(CAPTURE_TEXTURE_TIMEOUT))
+            throw std::runtime_error("Textures did not become resident, captured frames would not be reproducible");
+
+        for (uint32_t i = 0; i < options.warmupFrameCount; i++)
+            app.Render();
+        // GPU times of warmup frames are still pending in the frame slots, drop them
+        app.Flush();
+
+        std::vector<double> stallMilliseconds{};
+        std::vector<double> recordMilliseconds{};
+        std::vector<double> submitMilliseconds{};
+        std::vector<double> spriteNanoseconds{};
+        std::vector<double> gpuMilliseconds{};
+        std::vector<double> heapAllocations{};
+        stallMilliseconds.reserve(options.frameCount);
+        recordMilliseconds.reserve(options.frameCount);
+        submitMilliseconds.reserve(options.frameCount);
+        gpuMilliseconds.reserve(options.frameCount);
+        heapAllocations.reserve(options.frameCount);
+
+        for (uint32_t i = 0; i < options.frameCount; i++) {
+            auto const allocationCount{heapAllocationCount.load(std::memory_order_relaxed)};
+            app.Render();
+            // counted on every thread, worker threads included
+            heapAllocations.push_back(
+                static_cast<double>(heapAllocationCount.load(std::memory_order_relaxed) - allocationCount));
+            auto const &timings{app.GetFrameTimings()};
+            stallMilliseconds.push_back(timings.stallMilliseconds);
+            recordMilliseconds.push_back(timings.recordMilliseconds);
+            submitMilliseconds.push_back(timings.submitMilliseconds);
+            // CPU cost of one sprite, writing it into the transient buffer
+            if (options.spriteCount != 0)
+                spriteNanoseconds.push_back(timings.spriteMilliseconds * 1e6 / options.spriteCount);
+            if (timings.gpuMilliseconds)
+                gpuMilliseconds.push_back(*timings.gpuMilliseconds);
+        }
+        std::ranges::copy(app.Flush(), std::back_inserter(gpuMilliseconds));
+
+        auto const extent{app.GetTargetExtent()};
+        std::ofstream output{options.outputFilename};
+        if (!output)
+            throw std::runtime_error(std::format("Failed to open {}", options.outputFilename));
+        std::println(output, "{{");
+        std::println(output, R"(  "device": "{}",)", TraceRecorder::Escape(app.GetDeviceName()));
+        std::println(output, R"(  "width": {},)", extent.width);
+        std::println(output, R"(  "height": {},)", extent.height);
+        std::println(output, R"(  "frames": {},)", options.frameCount);
+        std::println(output, R"(  "frames_in_flight": {},)", options.inFlightFrameCount);
+        std::println(output, R"(  "record_workers": {},)", options.recordWorkerCount);
+        std::println(output, R"(  "sprites": {},)", options.spriteCount);
+        std::println(output, R"(  "cpu_stall_ms": {},)",
+                     ToJson(Summarize(stallMilliseconds), stallMilliseconds.size()));
+        std::println(output, R"(  "cpu_record_ms": {},)",
+                     ToJson(Summarize(recordMilliseconds), recordMilliseconds.size()));
+        std::println(output, R"(  "cpu_submit_ms": {},)",
+                     ToJson(Summarize(submitMilliseconds), submitMilliseconds.size()));
+        std::println(output, R"(  "cpu_sprite_ns": {},)",
+                     ToJson(Summarize(spriteNanoseconds), spriteNanoseconds.size()));
+        std::println(output, R"(  "gpu_ms": {},)", ToJson(Summarize(gpuMilliseconds), gpuMilliseconds.size()));
+        std::println(output, R"(  "heap_allocations_per_frame": {},)",
+                     ToJson(Summarize(heapAllocations), heapAllocations.size()));
+        // rolling averages over the last frames of every profiled zone, splitting the frame into record, passes and
+        // submission
+        auto const zones{app.GetProfileSummary()};
+        std::println(output, R"(  "zones": [)");
+        for (size_t i = 0; i < zones.size(); i++) {
+            auto const &[name, gpu, averageMilliseconds, maxMilliseconds, statistics]{zones[i]};
+            std::print(output, R"(    {{"name": "{}", "gpu": {}, "average_ms": {:.6f}, "max_ms": {:.6f})",
+                       TraceRecorder::Escape(name), gpu, averageMilliseconds, maxMilliseconds);
+            if (statistics)
+                std::print(output,
+                           R"(, "vertex_shader_invocations": {}, "clipping_primitives": {}, )"
+                           R"("fragment_shader_invocations": {}, "compute_shader_invocations": {})",
+                           statistics->vertexShaderInvocations, statistics->clippingPrimitives,
+                           statistics->fragmentShaderInvocations, statistics->computeShaderInvocations);
+            std::println(output, "}}{}", i + 1 == zones.size() ? "" : ",");
+        }
+        std::println(output, "  ],");
+        // usage of device local heaps against their budgets after the run
+        uint64_t deviceLocalUsage{};
+        uint64_t deviceLocalBudget{};
+        for (auto const &[flags, budget]: app.GetHeapBudgets())
+            if (flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+                deviceLocalUsage += budget.usage;
+                deviceLocalBudget += budget.budget;
+            }
+        std::println(output, R"(  "device_local_usage_bytes": {},)", deviceLocalUsage);
+        std::println(output, R"(  "device_local_budget_bytes": {})", deviceLocalBudget);
+        std::println(output, "}}");
+
+        std::println("Wrote {} frames to {}", options.frameCount, options.outputFilename);
+        if (auto const maxAllocations{std::ranges::max(heapAllocations)}; maxAllocations != 0)
+            std::println("Frames made up to {} heap allocations", maxAllocations);
+    }
+    catch (const SDLException &e) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error: %s", e.what());
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception &e) {
+        std::println(stderr, "Error: {}", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <SDL3/SDL.h>
+#include <SDL3_image/SDL_image.h>
+
+using Surface = std::unique_ptr<SDL_Surface, decltype(&SDL_DestroySurface)>;
+
+struct CompareOptions {
+    std::filesystem::path golden{};
+    std::filesystem::path actual{};
+    // Largest per channel difference still counted as equal, GPUs round blending and filtering differently
+    uint32_t tolerance{2};
+    // Pixels allowed to differ by more than the tolerance before an image fails
+    uint64_t maxDifferingPixels{};
+    // Where images showing the differing pixels of failed comparisons are written, empty writes none
+    std::filesystem::path diffDirectory{};
+};
+
+struct Comparison {
+    uint64_t differingPixels{};
+    uint32_t maxDifference{};
+};
+
+template<typename T>
+static T ParseNumber(std::string_view const argument, std::string_view const value) {
+    T result{};
+    auto const [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc{} || end != value.data() + value.size())
+        throw std::runtime_error(std::format("Invalid value for {}: {}", argument, value));
+    return result;
+}
+
+static CompareOptions ParseArguments(int const argc, char **argv) {
+    CompareOptions options{};
+    std::vector<std::string_view> paths{};
+    for (int i = 1; i < argc; i++) {
+        std::string_view const argument{argv[i]};
+        if (!argument.starts_with("--")) {
+            paths.push_back(argument);
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::runtime_error(std::format("Missing value for {}", argument));
+        std::string_view const value{argv[++i]};
+        if (argument == "--tolerance")
+            options.tolerance = ParseNumber<uint32_t>(argument, value);
+        else if (argument == "--max-differing-pixels")
+            options.maxDifferingPixels = ParseNumber<uint64_t>(argument, value);
+        else if (argument == "--diff")
+            options.diffDirectory = value;
+        else
+            throw std::runtime_error(std::format("Unknown argument: {}", argument));
+    }
+    if (paths.size() != 2)
+        throw std::runtime_error("Expected a golden and an actual image or directory");
+    options.golden = paths[0];
+    options.actual = paths[1];
+    return options;
+}
+
+// Loads an image as RGBA32, whatever it was stored as
+static Surface Load(std::filesystem::path const &filename) {
+    Surface const surface{IMG_Load(filename.string().c_str()), SDL_DestroySurface};
+    if (!surface)
+        throw std::runtime_error(std::format("Failed to load {}: {}", filename.string(), SDL_GetError()));
+    Surface converted{SDL_ConvertSurface(surface.get(), SDL_PIXELFORMAT_RGBA32), SDL_DestroySurface};
+    if (!converted)
+        throw std::runtime_error(std::format("Failed to convert {}: {}", filename.string(), SDL_GetError()));
+    return converted;
+}
+
+// Counts the pixels with any channel differing by more than tolerance. When diff is given, it gets those pixels in
+// red over a darkened grey copy of the golden image.
+static Comparison Compare(SDL_Surface const &golden, SDL_Surface const &actual, uint32_t const tolerance,
+                          SDL_Surface *const diff) {
+    Comparison comparison{};
+    for (int y = 0; y < golden.h; y++) {
+        auto const goldenRow{static_cast<uint8_t const *>(golden.pixels) + static_cast<size_t>(y) * golden.pitch};
+        auto const actualRow{static_cast<uint8_t const *>(actual.pixels) + static_cast<size_t>(y) * actual.pitch};
+        auto const diffRow{
+            diff ? static_cast<uint8_t *>(diff->pixels) + static_cast<size_t>(y) * diff->pitch : nullptr
+        };
+        for (int x = 0; x < golden.w; x++) {
+            uint32_t difference{};
+            for (int channel = 0; channel < 4; channel++)
+                difference = std::max(difference, static_cast<uint32_t>(
+                                          std::abs(goldenRow[x * 4 + channel] - actualRow[x * 4 + channel])));
+            comparison.maxDifference = std::max(comparison.maxDifference, difference);
+            auto const differs{difference > tolerance};
+            if (differs)
+                comparison.differingPixels++;
+            if (!diffRow)
+                continue;
+            auto const grey{
+                static_cast<uint8_t>((goldenRow[x * 4] + goldenRow[x * 4 + 1] + goldenRow[x * 4 + 2]) / 12)
+            };
+            diffRow[x * 4] = differs ? 255 : grey;
+            diffRow[x * 4 + 1] = differs ? 0 : grey;
+            diffRow[x * 4 + 2] = differs ? 0 : grey;
+            diffRow[x * 4 + 3] = 255;
+        }
+    }
+    return comparison;
+}
+
+// Returns whether the pair passed, printing one line about it either way
+static bool ComparePair(CompareOptions const &options, std::filesystem::path const &goldenFilename,
+                        std::filesystem::path const &actualFilename) {
+    auto const name{goldenFilename.filename().string()};
+    if (!std::filesystem::exists(actualFilename)) {
+        std::println("FAIL {}: missing {}", name, actualFilename.string());
+        return false;
+    }
+    auto const golden{Load(goldenFilename)};
+    auto const actual{Load(actualFilename)};
+    if (golden->w != actual->w || golden->h != actual->h) {
+        std::println("FAIL {}: {}x{} instead of {}x{}", name, actual->w, actual->h, golden->w, golden->h);
+        return false;
+    }
+
+    Surface diff{nullptr, SDL_DestroySurface};
+    if (!options.diffDirectory.empty()) {
+        diff.reset(SDL_CreateSurface(golden->w, golden->h, SDL_PIXELFORMAT_RGBA32));
+        if (!diff)
+            throw std::runtime_error(std::format("Failed to create diff image: {}", SDL_GetError()));
+    }
+    auto const [differingPixels, maxDifference]{Compare(*golden, *actual, options.tolerance, diff.get())};
+    auto const passed{differingPixels <= options.maxDifferingPixels};
+    std::println("{} {}: {} of {} pixels differ by more than {}, by up to {}", passed ? "PASS" : "FAIL", name,
+                 differingPixels, static_cast<uint64_t>(golden->w) * golden->h, options.tolerance, maxDifference);
+
+    if (!passed && diff) {
+        std::filesystem::create_directories(options.diffDirectory);
+        auto const diffFilename{(options.diffDirectory / name).string()};
+        if (!IMG_SavePNG(diff.get(), diffFilename.c_str()))
+            std::println(stderr, "Failed to write {}: {}", diffFilename, SDL_GetError());
+    }
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    try {
+        auto const options{ParseArguments(argc, argv)};
+        if (!std::filesystem::is_directory(options.golden))
+            return ComparePair(options, options.golden, options.actual) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        std::vector<std::filesystem::path> goldenFilenames{};
+        for (auto const &entry: std::filesystem::directory_iterator{options.golden})
+            if (entry.is_regular_file() && entry.path().extension() == ".png")
+                goldenFilenames.push_back(entry.path());
+        if (goldenFilenames.empty())
+            throw std::runtime_error(std::format("No golden images in {}", options.golden.string()));
+        std::ranges::sort(goldenFilenames);
+
+        uint32_t failedCount{};
+        for (auto const &goldenFilename: goldenFilenames)
+            if (!ComparePair(options, goldenFilename, options.actual / goldenFilename.filename()))
+                failedCount++;
+        std::println("{} of {} images passed", goldenFilenames.size() - failedCount, goldenFilenames.size());
+        return failedCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (const std::exception &e) {
+        std::println(stderr, "Error: {}", e.what());
+        return EXIT_FAILURE;
+    }
+}
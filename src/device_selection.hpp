@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "pipeline.hpp"
+
+constexpr uint32_t NO_QUEUE_FAMILY{UINT32_MAX};
+
+// What device selection needs to know about a physical device, probed once and cached on disk. Plain data, the cache
+// file is an array of these.
+struct DeviceCapabilities {
+    // Together the cache key, the pipeline cache UUID changes with the driver and the device UUID tells identical
+    // GPUs apart
+    std::array<uint8_t, VK_UUID_SIZE> pipelineCacheUUID{};
+    std::array<uint8_t, VK_UUID_SIZE> deviceUUID{};
+
+    uint32_t apiVersion{};
+    vk::PhysicalDeviceType deviceType{};
+    // Largest device local heap, the VRAM of discrete GPUs
+    uint64_t deviceLocalBytes{};
+    // Every feature the renderer enables unconditionally
+    bool requiredFeatures{};
+    bool swapchain{};
+    bool memoryBudget{};
+
+    // Bit i is set when queue family i supports graphics, present support depends on the surface and is not cached
+    uint32_t graphicsQueueFamilies{};
+    // Bit i is set when queue family i has timestamps
+    uint32_t timestampQueueFamilies{};
+    // Transfer family without graphics, transfer-only preferred; NO_QUEUE_FAMILY when there is none
+    uint32_t transferQueueFamilyIndex{NO_QUEUE_FAMILY};
+    vk::Extent3D transferGranularity{};
+    // Compute family without graphics; NO_QUEUE_FAMILY when there is none
+    uint32_t computeQueueFamilyIndex{NO_QUEUE_FAMILY};
+};
+
+static_assert(std::is_trivially_copyable_v<DeviceCapabilities>, "the cache file is a raw copy of the entries");
+
+// Reads every capability from the driver, which means enumerating features, extensions, memory heaps and queues
+inline DeviceCapabilities ProbeDeviceCapabilities(vk::raii::PhysicalDevice const &physicalDevice) {
+    DeviceCapabilities capabilities{};
+    auto const propertiesChain{
+        physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>()
+    };
+    auto const &properties{propertiesChain.get<vk::PhysicalDeviceProperties2>().properties};
+    capabilities.pipelineCacheUUID = properties.pipelineCacheUUID;
+    capabilities.deviceUUID = propertiesChain.get<vk::PhysicalDeviceIDProperties>().deviceUUID;
+    capabilities.apiVersion = properties.apiVersion;
+    capabilities.deviceType = properties.deviceType;
+
+    // the 1.3 feature structure may only be chained for devices that support 1.3
+    if (properties.apiVersion >= vk::makeApiVersion(0, 1, 3, 0)) {
+        auto const featuresChain{
+            physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features,
+                vk::PhysicalDeviceVulkan13Features>()
+        };
+        auto const &vulkan12Features{featuresChain.get<vk::PhysicalDeviceVulkan12Features>()};
+        auto const &vulkan13Features{featuresChain.get<vk::PhysicalDeviceVulkan13Features>()};
+        capabilities.requiredFeatures = vulkan12Features.timelineSemaphore && vulkan12Features.descriptorIndexing &&
+            vulkan12Features.runtimeDescriptorArray && vulkan12Features.descriptorBindingPartiallyBound &&
+            vulkan12Features.descriptorBindingSampledImageUpdateAfterBind &&
+            vulkan12Features.shaderSampledImageArrayNonUniformIndexing && vulkan13Features.synchronization2 &&
+            vulkan13Features.dynamicRendering;
+    }
+
+    for (auto const &extension: physicalDevice.enumerateDeviceExtensionProperties()) {
+        if (std::strcmp(extension.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0)
+            capabilities.swapchain = true;
+        if (std::strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+            capabilities.memoryBudget = true;
+    }
+
+    auto const memoryProperties{physicalDevice.getMemoryProperties()};
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+            capabilities.deviceLocalBytes = std::max(capabilities.deviceLocalBytes,
+                                                     memoryProperties.memoryHeaps[i].size);
+
+    // Prefer a transfer-only family (DMA engine) for streaming, then any non-graphics one
+    auto const queueFamilies{physicalDevice.getQueueFamilyProperties()};
+    auto bestTransferScore{0};
+    for (uint32_t i = 0; i < std::min<size_t>(queueFamilies.size(), 32); i++) {
+        auto const flags{queueFamilies[i].queueFlags};
+        if (flags & vk::QueueFlagBits::eGraphics)
+            capabilities.graphicsQueueFamilies |= 1u << i;
+        if (queueFamilies[i].timestampValidBits != 0)
+            capabilities.timestampQueueFamilies |= 1u << i;
+        if (flags & vk::QueueFlagBits::eGraphics)
+            continue;
+        if (flags & vk::QueueFlagBits::eCompute && capabilities.computeQueueFamilyIndex == NO_QUEUE_FAMILY)
+            capabilities.computeQueueFamilyIndex = i;
+        if (!(flags & vk::QueueFlagBits::eTransfer))
+            continue;
+        auto const score{flags & vk::QueueFlagBits::eCompute ? 1 : 2};
+        if (score > bestTransferScore) {
+            bestTransferScore = score;
+            capabilities.transferQueueFamilyIndex = i;
+            capabilities.transferGranularity = queueFamilies[i].minImageTransferGranularity;
+        }
+    }
+    return capabilities;
+}
+
+// Zero for devices the renderer can't run on, otherwise higher is faster: the device type dominates, then VRAM, then
+// queues that let streaming and compute run next to graphics
+inline uint64_t ScoreDevice(DeviceCapabilities const &capabilities) {
+    if (capabilities.apiVersion < vk::makeApiVersion(0, 1, 3, 0) || !capabilities.requiredFeatures ||
+        capabilities.graphicsQueueFamilies == 0)
+        return 0;
+    uint64_t score{};
+    switch (capabilities.deviceType) {
+        case vk::PhysicalDeviceType::eDiscreteGpu: score += 100000;
+            break;
+        case vk::PhysicalDeviceType::eIntegratedGpu: score += 50000;
+            break;
+        case vk::PhysicalDeviceType::eVirtualGpu: score += 20000;
+            break;
+        case vk::PhysicalDeviceType::eCpu: score += 1;
+            break;
+        default: score += 10000;
+            break;
+    }
+    // one point per 64 MiB, a 16 GiB card gets 256
+    score += capabilities.deviceLocalBytes >> 26;
+    if (capabilities.transferQueueFamilyIndex != NO_QUEUE_FAMILY)
+        score += 100;
+    if (capabilities.computeQueueFamilyIndex != NO_QUEUE_FAMILY)
+        score += 100;
+    return score;
+}
+
+// Prefix of the device capability cache file
+struct DeviceCacheFileHeader {
+    static constexpr uint32_t MAGIC{0x43445643}; // "CVDC"
+    static constexpr uint32_t VERSION{1};
+
+    uint32_t magic{};
+    uint32_t version{};
+    uint32_t entryCount{};
+    uint32_t reserved{};
+    uint64_t dataHash{};
+};
+
+// Capabilities of every device seen on this machine, so starting up only costs reading device properties. Entries are
+// only used by the exact device and driver that wrote them.
+class DeviceCapabilityCache {
+    std::filesystem::path filename;
+    std::vector<DeviceCapabilities> entries{};
+    bool dirty{};
+
+public:
+    explicit DeviceCapabilityCache(std::filesystem::path filename) : filename{std::move(filename)} {
+        if (this->filename.empty())
+            return;
+        auto const file{ReadBinaryFile(this->filename)};
+        if (file.empty())
+            return;
+        if (auto const error{Load(file)})
+            std::println("Discarding device cache {}: {}", this->filename.string(), error);
+    }
+
+    // Cached capabilities of the device, probed and added to the cache on a miss
+    DeviceCapabilities const &Get(vk::raii::PhysicalDevice const &physicalDevice) {
+        auto const propertiesChain{
+            physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>()
+        };
+        auto const &pipelineCacheUUID{
+            propertiesChain.get<vk::PhysicalDeviceProperties2>().properties.pipelineCacheUUID
+        };
+        auto const &deviceUUID{propertiesChain.get<vk::PhysicalDeviceIDProperties>().deviceUUID};
+        for (auto const &entry: entries)
+            if (std::ranges::equal(entry.pipelineCacheUUID, pipelineCacheUUID) &&
+                std::ranges::equal(entry.deviceUUID, deviceUUID))
+                return entry;
+        // a new driver changes the pipeline cache UUID, the stale entry goes away with it
+        std::erase_if(entries, [&](DeviceCapabilities const &entry) {
+            return std::ranges::equal(entry.deviceUUID, deviceUUID);
+        });
+        entries.push_back(ProbeDeviceCapabilities(physicalDevice));
+        dirty = true;
+        return entries.back();
+    }
+
+    // Writes the cache if anything was probed, through a temporary file like the pipeline cache
+    void Save() {
+        if (!dirty || filename.empty())
+            return;
+        dirty = false;
+        std::span const data{
+            reinterpret_cast<char const *>(entries.data()), entries.size() * sizeof(DeviceCapabilities)
+        };
+        DeviceCacheFileHeader const header{
+            DeviceCacheFileHeader::MAGIC, DeviceCacheFileHeader::VERSION, static_cast<uint32_t>(entries.size()), 0,
+            HashBytes(data)
+        };
+
+        auto temporaryFilename{filename};
+        temporaryFilename += ".tmp";
+        {
+            std::ofstream file{temporaryFilename, std::ios::binary | std::ios::trunc};
+            file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if (!file) {
+                std::println("Failed to write device cache {}", temporaryFilename.string());
+                return;
+            }
+        }
+        std::error_code error{};
+        std::filesystem::rename(temporaryFilename, filename, error);
+        if (error)
+            std::println("Failed to write device cache {}: {}", filename.string(), error.message());
+    }
+
+private:
+    [[nodiscard]] char const *Load(std::span<char const> const file) {
+        if (file.size() < sizeof(DeviceCacheFileHeader))
+            return "truncated header";
+        DeviceCacheFileHeader header{};
+        std::memcpy(&header, file.data(), sizeof(header));
+        auto const data{file.subspan(sizeof(header))};
+        if (header.magic != DeviceCacheFileHeader::MAGIC || header.version != DeviceCacheFileHeader::VERSION)
+            return "unknown format";
+        if (data.size() != header.entryCount * sizeof(DeviceCapabilities) || header.dataHash != HashBytes(data))
+            return "corrupted data";
+        entries.resize(header.entryCount);
+        std::memcpy(entries.data(), data.data(), data.size());
+        return nullptr;
+    }
+};
+
+struct DeviceSelection {
+    uint32_t index{};
+    DeviceCapabilities capabilities{};
+    uint32_t graphicsQueueFamilyIndex{};
+};
+
+// Picks the highest scoring device with a graphics queue family that can present to surface, any graphics family when
+// surface is null. overrideDevice, when not empty, is an index into physicalDevices or part of a device name (case
+// insensitive), and the first usable device it matches wins over the score.
+inline DeviceSelection SelectPhysicalDevice(std::span<vk::raii::PhysicalDevice const> const physicalDevices,
+                                            vk::SurfaceKHR const surface, DeviceCapabilityCache &cache,
+                                            std::string_view const overrideDevice) {
+    auto const matchesOverride{
+        [&](uint32_t const index, std::string_view const name) {
+            if (overrideDevice.empty())
+                return false;
+            uint32_t overrideIndex{};
+            auto const [end, error] = std::from_chars(overrideDevice.data(),
+                                                      overrideDevice.data() + overrideDevice.size(), overrideIndex);
+            if (error == std::errc{} && end == overrideDevice.data() + overrideDevice.size())
+                return overrideIndex == index;
+            return std::ranges::search(name, overrideDevice, [](char const a, char const b) {
+                return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+            }).begin() != name.end();
+        }
+    };
+
+    std::optional<DeviceSelection> best{};
+    uint64_t bestScore{};
+    bool overridden{};
+    for (uint32_t i = 0; i < physicalDevices.size(); i++) {
+        auto const &physicalDevice{physicalDevices[i]};
+        auto const &capabilities{cache.Get(physicalDevice)};
+        auto const properties{physicalDevice.getProperties()};
+        std::string_view const name{properties.deviceName.data(), std::strlen(properties.deviceName)};
+
+        // present support depends on the surface, so it is the one thing asked every time
+        auto graphicsQueueFamilyIndex{NO_QUEUE_FAMILY};
+        for (uint32_t family = 0; family < 32 && (!surface || capabilities.swapchain); family++) {
+            if (!(capabilities.graphicsQueueFamilies & 1u << family))
+                continue;
+            if (!surface || physicalDevice.getSurfaceSupportKHR(family, surface)) {
+                graphicsQueueFamilyIndex = family;
+                break;
+            }
+        }
+        auto const score{graphicsQueueFamilyIndex == NO_QUEUE_FAMILY ? 0 : ScoreDevice(capabilities)};
+        std::println("Device {}: {} (score {})", i, name, score);
+        if (score == 0)
+            continue;
+
+        auto const isOverride{matchesOverride(i, name)};
+        // the first device matching the override wins, otherwise the highest score
+        if (overridden || (!isOverride && score <= bestScore))
+            continue;
+        best = DeviceSelection{i, capabilities, graphicsQueueFamilyIndex};
+        bestScore = score;
+        overridden = isOverride;
+    }
+    cache.Save();
+
+    if (!best)
+        throw std::runtime_error("No Vulkan device supports the required features");
+    if (!overrideDevice.empty() && !overridden)
+        std::println("No usable device matches \"{}\", using the highest scoring one", overrideDevice);
+    return *best;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "memory.hpp"
+
+// Bump allocator for CPU scratch that lives until the frame slot is reused. Deallocation is a no-op, Reset() rewinds
+// everything at once. Blocks are only ever added, so once the arena has seen the largest frame it stops touching the
+// heap; a reset merges them into one block big enough for everything the previous frame needed.
+class HostArena final : public std::pmr::memory_resource {
+    struct Block {
+        std::unique_ptr<std::byte[]> data{};
+        size_t size{};
+    };
+
+    std::vector<Block> blocks{};
+    size_t used{};
+    // Bytes handed out since the last reset, over every block
+    size_t allocatedBytes{};
+
+public:
+    HostArena() : HostArena(64 << 10) {}
+
+    explicit HostArena(size_t const initialSize) {
+        blocks.push_back(Block{std::make_unique<std::byte[]>(initialSize), initialSize});
+    }
+
+    // Moving keeps the blocks, but containers still refer to the old arena, so only move it before using it
+    HostArena(HostArena &&) = default;
+    HostArena &operator=(HostArena &&) = default;
+
+    // Everything allocated since the last reset must no longer be in use
+    void Reset() {
+        if (blocks.size() > 1) {
+            size_t totalSize{};
+            for (auto const &block: blocks)
+                totalSize += block.size;
+            blocks.clear();
+            blocks.push_back(Block{std::make_unique<std::byte[]>(totalSize), totalSize});
+        }
+        used = 0;
+        allocatedBytes = 0;
+    }
+
+    [[nodiscard]] size_t GetAllocatedBytes() const { return allocatedBytes; }
+
+private:
+    void *do_allocate(size_t const bytes, size_t const alignment) override {
+        auto &block{blocks.back()};
+        // aligned by address, blocks themselves are only aligned for new
+        void *pointer{block.data.get() + used};
+        auto space{block.size - used};
+        if (!std::align(alignment, bytes, pointer, space)) {
+            // only while warming up, the next reset folds the new block into the first one
+            auto const size{std::max(block.size * 2, bytes + alignment)};
+            blocks.push_back(Block{std::make_unique<std::byte[]>(size), size});
+            used = 0;
+            return do_allocate(bytes, alignment);
+        }
+        used = block.size - space + bytes;
+        allocatedBytes += bytes;
+        return pointer;
+    }
+
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    [[nodiscard]] bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Sub-allocation of a TransientBuffer, valid until the frame slot it was made for is reused
+struct TransientAllocation {
+    vk::Buffer buffer{};
+    vk::DeviceSize offset{};
+    std::byte *data{};
+};
+
+// Persistently mapped buffer for data the GPU reads in the frame it was written for, such as instance data or
+// uniforms. It is split into one segment per frame slot and each segment is sub-allocated linearly with aligned
+// offsets, so a frame's allocations are released together when the slot's timeline value has been reached. Only the
+// render thread allocates.
+class TransientBuffer {
+    AllocatedBuffer buffer{};
+    std::byte *mappedData{};
+    vk::DeviceSize segmentSize;
+    vk::DeviceSize minAlignment;
+
+    vk::DeviceSize segmentBegin{};
+    vk::DeviceSize head{};
+
+public:
+    TransientBuffer(vk::raii::PhysicalDevice const &physicalDevice, Allocator &allocator,
+                    uint32_t const frameSlotCount, vk::DeviceSize const segmentSize)
+        : segmentSize{segmentSize} {
+        auto const &limits{physicalDevice.getProperties().limits};
+        minAlignment = std::max({
+            limits.minStorageBufferOffsetAlignment, limits.minUniformBufferOffsetAlignment,
+            limits.nonCoherentAtomSize
+        });
+        // segments start on an aligned offset, so alignments within a segment carry over to the buffer
+        this->segmentSize = (segmentSize + minAlignment - 1) / minAlignment * minAlignment;
+        // shaders bind the whole buffer and index into it
+        if (this->segmentSize * frameSlotCount > limits.maxStorageBufferRange)
+            throw std::runtime_error("Transient buffer is larger than the maximum storage buffer range");
+
+        vk::BufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.size = this->segmentSize * frameSlotCount;
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eUniformBuffer |
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+            vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferSrc;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        buffer = allocator.CreateBuffer(bufferCreateInfo, allocationCreateInfo, AllocationCategory::Dynamic);
+        mappedData = static_cast<std::byte *>(buffer.GetMappedData());
+    }
+
+    TransientBuffer(TransientBuffer const &) = delete;
+    TransientBuffer &operator=(TransientBuffer const &) = delete;
+
+    // Switches to the frame slot's segment and releases everything allocated in it, the slot's previous submission
+    // has to have completed
+    void Reset(uint32_t const frameSlot) {
+        segmentBegin = frameSlot * segmentSize;
+        head = segmentBegin;
+    }
+
+    // Alignment does not have to be a power of two, element sized alignments let shaders index from the offset.
+    // Returns nothing once the segment is full.
+    std::optional<TransientAllocation> Allocate(vk::DeviceSize const size, vk::DeviceSize const alignment = 16) {
+        auto const offset{(head + alignment - 1) / alignment * alignment};
+        if (offset + size > segmentBegin + segmentSize)
+            return std::nullopt;
+        head = offset + size;
+        return TransientAllocation{buffer.Get(), offset, mappedData + offset};
+    }
+
+    // Makes everything written into the current segment visible to the device, call once before submitting
+    void Flush() const {
+        if (head != segmentBegin)
+            buffer.Flush(segmentBegin, head - segmentBegin);
+    }
+
+    [[nodiscard]] vk::Buffer GetBuffer() const { return buffer.Get(); }
+    [[nodiscard]] vk::DeviceSize GetSegmentSize() const { return segmentSize; }
+    [[nodiscard]] vk::DeviceSize GetUsedBytes() const { return head - segmentBegin; }
+};
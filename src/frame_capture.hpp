@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <SDL3/SDL.h>
+#include <SDL3_image/SDL_image.h>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "memory.hpp"
+#include "render_graph.hpp"
+
+enum class CaptureFormat {
+    // One PNG file per frame, encoded in parallel
+    Png,
+    // Frames appended to one file per extent, ready for ffmpeg's rawvideo demuxer
+    Raw,
+};
+
+// Writes every rendered frame to disk. The frame's final image is copied into one of a ring of host visible readback
+// buffers at the end of the frame, and once the frame timeline shows the copy has completed, worker threads encode the
+// buffer's texels straight from mapped memory. Nothing ever waits for the frame that was just submitted. Frames are
+// never dropped either: when every buffer is still in flight or being encoded, the next capture waits for the oldest.
+class FrameCapture {
+    struct Slot {
+        AllocatedBuffer buffer{};
+        std::byte const *data{};
+        vk::Extent2D extent{};
+        // Frame timeline value of the frame whose copy the buffer holds, zero once that frame has been handed over
+        uint64_t frameValue{};
+        // Set while a worker encodes the buffer, guarded by the mutex
+        bool encoding{};
+    };
+
+    struct EncodeJob {
+        uint32_t slot{};
+        uint64_t frameValue{};
+    };
+
+    vk::raii::Device const &device;
+    Allocator &allocator;
+    vk::Semaphore frameTimeline;
+    std::filesystem::path directory;
+    CaptureFormat format;
+    SDL_PixelFormat pixelFormat;
+    std::string_view pixelFormatName;
+
+    std::vector<Slot> slots;
+    uint32_t nextSlot{};
+    uint64_t capturedCount{};
+
+    std::mutex mutex{};
+    std::condition_variable_any jobAvailable{};
+    std::condition_variable slotEncoded{};
+    std::deque<EncodeJob> jobs{};
+    uint32_t encodingCount{};
+    // Only touched by the single raw worker
+    std::ofstream rawStream{};
+    vk::Extent2D rawExtent{};
+    uint32_t rawFileCount{};
+    std::vector<std::jthread> workers{};
+
+public:
+    // frameTimeline is signaled with the frame values passed to AddCapturePass. Raw streams are written by a single
+    // worker to keep the frames in order, PNG files by workerCount workers.
+    FrameCapture(vk::raii::Device const &device, Allocator &allocator, vk::Semaphore const frameTimeline,
+                 std::filesystem::path directory, CaptureFormat const format, vk::Format const targetFormat,
+                 uint32_t const slotCount, uint32_t const workerCount)
+        : device{device}, allocator{allocator}, frameTimeline{frameTimeline}, directory{std::move(directory)},
+          format{format}, slots(slotCount) {
+        switch (targetFormat) {
+            case vk::Format::eB8G8R8A8Srgb:
+            case vk::Format::eB8G8R8A8Unorm:
+                pixelFormat = SDL_PIXELFORMAT_BGRA32;
+                pixelFormatName = "bgra";
+                break;
+            case vk::Format::eR8G8B8A8Srgb:
+            case vk::Format::eR8G8B8A8Unorm:
+                pixelFormat = SDL_PIXELFORMAT_RGBA32;
+                pixelFormatName = "rgba";
+                break;
+            default:
+                throw std::runtime_error(std::format("Capturing {} targets is not supported",
+                                                     vk::to_string(targetFormat)));
+        }
+        std::filesystem::create_directories(this->directory);
+
+        auto const threadCount{format == CaptureFormat::Raw ? 1 : std::max(workerCount, 1u)};
+        for (uint32_t i = 0; i < threadCount; i++)
+            workers.emplace_back([this](std::stop_token const &stopToken) { EncodeLoop(stopToken); });
+    }
+
+    // The device has to be idle, every captured frame is written before this returns
+    ~FrameCapture() {
+        Finish();
+        workers.clear();
+        if (capturedCount != 0)
+            std::println("Captured {} frames to {}", capturedCount, directory.string());
+    }
+
+    FrameCapture(FrameCapture const &) = delete;
+    FrameCapture &operator=(FrameCapture const &) = delete;
+
+    // Adds a pass copying target, the image of the frame that will signal frameValue, into the next readback buffer.
+    // Has to come after every pass writing target. Waits when the buffer is still in use.
+    void AddCapturePass(RenderGraph &renderGraph, RenderGraph::ImageHandle const target, vk::Image const targetImage,
+                        vk::Extent2D const extent, uint64_t const frameValue) {
+        auto &slot{AcquireSlot()};
+        if (!slot.buffer || slot.extent != extent) {
+            vk::BufferCreateInfo bufferCreateInfo{};
+            bufferCreateInfo.size = static_cast<vk::DeviceSize>(extent.width) * extent.height * 4;
+            bufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferDst;
+            VmaAllocationCreateInfo allocationCreateInfo{};
+            allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            // read back by the CPU, so cached memory even where that means invalidating
+            allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            slot.buffer = allocator.CreateBuffer(bufferCreateInfo, allocationCreateInfo,
+                                                 AllocationCategory::Readback);
+            slot.data = static_cast<std::byte const *>(slot.buffer.GetMappedData());
+            slot.extent = extent;
+        }
+        slot.frameValue = frameValue;
+
+        std::array const accesses{RenderGraph::ImageAccess{target, ResourceUsage::TransferSrc}};
+        renderGraph.AddPass("capture", accesses,
+                            [buffer{slot.buffer.Get()}, targetImage, extent](
+                        vk::raii::CommandBuffer const &commandBuffer) {
+                                commandBuffer.copyImageToBuffer(
+                                    targetImage, vk::ImageLayout::eTransferSrcOptimal, buffer,
+                                    vk::BufferImageCopy{
+                                        0, 0, 0,
+                                        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                                        vk::Offset3D{}, vk::Extent3D{extent.width, extent.height, 1}
+                                    });
+                            });
+        capturedCount++;
+    }
+
+    // Hands the buffers of frames up to completedValue to the workers, oldest first. Never waits for the GPU.
+    void Drain(uint64_t const completedValue) {
+        std::vector<EncodeJob> completed{};
+        for (uint32_t i = 0; i < slots.size(); i++)
+            if (slots[i].frameValue != 0 && slots[i].frameValue <= completedValue)
+                completed.push_back({i, slots[i].frameValue});
+        if (completed.empty())
+            return;
+        std::ranges::sort(completed, {}, &EncodeJob::frameValue);
+
+        std::scoped_lock lock{mutex};
+        for (auto const &job: completed) {
+            auto &slot{slots[job.slot]};
+            slot.buffer.Invalidate(0, vk::WholeSize);
+            slot.frameValue = 0;
+            slot.encoding = true;
+            jobs.push_back(job);
+        }
+        jobAvailable.notify_all();
+    }
+
+    // Writes every captured frame and waits until they are on disk, the device has to be idle
+    void Finish() {
+        Drain(UINT64_MAX);
+        std::unique_lock lock{mutex};
+        slotEncoded.wait(lock, [this] { return jobs.empty() && encodingCount == 0; });
+    }
+
+private:
+    // The next slot in ring order, so the one whose frame was submitted longest ago
+    Slot &AcquireSlot() {
+        auto &slot{slots[nextSlot]};
+        nextSlot = (nextSlot + 1) % static_cast<uint32_t>(slots.size());
+        if (slot.frameValue != 0) {
+            vk::SemaphoreWaitInfo waitInfo{};
+            waitInfo.setSemaphores(frameTimeline);
+            waitInfo.setValues(slot.frameValue);
+            auto _ = device.waitSemaphores(waitInfo, UINT64_MAX);
+            Drain(slot.frameValue);
+        }
+        std::unique_lock lock{mutex};
+        slotEncoded.wait(lock, [&slot] { return !slot.encoding; });
+        return slot;
+    }
+
+    void EncodeLoop(std::stop_token const &stopToken) {
+        while (true) {
+            EncodeJob job;
+            {
+                std::unique_lock lock{mutex};
+                if (!jobAvailable.wait(lock, stopToken, [this] { return !jobs.empty(); }))
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+                encodingCount++;
+            }
+
+            auto const &slot{slots[job.slot]};
+            if (format == CaptureFormat::Png)
+                WritePng(slot, job.frameValue);
+            else
+                WriteRaw(slot);
+
+            std::scoped_lock lock{mutex};
+            slots[job.slot].encoding = false;
+            encodingCount--;
+            slotEncoded.notify_all();
+        }
+    }
+
+    void WritePng(Slot const &slot, uint64_t const frameValue) const {
+        auto const filename{(directory / std::format("frame_{:06}.png", frameValue)).string()};
+        auto const surface{
+            SDL_CreateSurfaceFrom(static_cast<int>(slot.extent.width), static_cast<int>(slot.extent.height),
+                                  pixelFormat, const_cast<std::byte *>(slot.data),
+                                  static_cast<int>(slot.extent.width * 4))
+        };
+        if (!surface || !IMG_SavePNG(surface, filename.c_str()))
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to write %s: %s", filename.c_str(), SDL_GetError());
+        SDL_DestroySurface(surface);
+    }
+
+    // A new file whenever the extent changes, since a raw stream has no header to tell frames of different sizes apart
+    void WriteRaw(Slot const &slot) {
+        if (!rawStream.is_open() || rawExtent != slot.extent) {
+            rawStream.close();
+            rawExtent = slot.extent;
+            auto const filename{
+                directory / std::format("capture_{}_{}x{}_{}.raw", rawFileCount++, rawExtent.width,
+                                        rawExtent.height, pixelFormatName)
+            };
+            rawStream.open(filename, std::ios::binary | std::ios::trunc);
+            if (!rawStream)
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to open %s", filename.string().c_str());
+        }
+        rawStream.write(reinterpret_cast<char const *>(slot.data),
+                        static_cast<std::streamsize>(slot.extent.width) * slot.extent.height * 4);
+    }
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <SDL3/SDL.h>
+#include <SDL3_image/SDL_image.h>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include "trace.hpp"
+#include "pixel_conversion.hpp"
+
+using StreamTicket = uint32_t;
+
+// Texel block dimensions of a format, one texel and its size for uncompressed formats
+struct FormatBlock {
+    vk::Extent2D extent{};
+    uint32_t size{};
+};
+
+inline FormatBlock GetFormatBlock(vk::Format const format) {
+    auto const extent{vk::blockExtent(format)};
+    return {{extent[0], extent[1]}, vk::blockSize(format)};
+}
+
+// One mip level of a DecodedImage, its rows of texel blocks start at offset and are rowPitch bytes apart
+struct ImageLevel {
+    vk::Extent2D extent{};
+    size_t offset{};
+    size_t rowPitch{};
+};
+
+// A decoded image, 8 bit per channel color from SDL_image or the levels of a KTX2 container exactly as stored, block
+// compressed formats included. The receiver owns it.
+struct DecodedImage {
+    StreamTicket ticket{};
+    vk::Format format{};
+    // Applied to every row on its way to staging memory
+    PixelConversion conversion{PixelConversion::None};
+    std::vector<ImageLevel> levels{};
+    // Mip levels of the GPU image, the ones past levels.size() have to be generated on the GPU
+    uint32_t mipLevels{1};
+    std::unique_ptr<SDL_Surface, decltype(&SDL_DestroySurface)> surface{nullptr, SDL_DestroySurface};
+    std::vector<std::byte> fileData{};
+
+    [[nodiscard]] std::byte const *GetPixels() const {
+        return surface ? static_cast<std::byte const *>(surface->pixels) : fileData.data();
+    }
+};
+
+// Fixed part of a KTX2 file, followed by one KTX2LevelIndex per level
+struct KTX2Header {
+    std::array<uint8_t, 12> identifier{};
+    uint32_t vkFormat{};
+    uint32_t typeSize{};
+    uint32_t pixelWidth{};
+    uint32_t pixelHeight{};
+    uint32_t pixelDepth{};
+    uint32_t layerCount{};
+    uint32_t faceCount{};
+    uint32_t levelCount{};
+    uint32_t supercompressionScheme{};
+    uint32_t dfdByteOffset{};
+    uint32_t dfdByteLength{};
+    uint32_t kvdByteOffset{};
+    uint32_t kvdByteLength{};
+    uint64_t sgdByteOffset{};
+    uint64_t sgdByteLength{};
+};
+static_assert(sizeof(KTX2Header) == 80);
+
+struct KTX2LevelIndex {
+    uint64_t byteOffset{};
+    uint64_t byteLength{};
+    uint64_t uncompressedByteLength{};
+};
+
+// Surface formats SDL_image decodes to with the VkFormat of the same byte order, rows of these are converted while
+// they are copied to staging memory instead of converting the whole surface into another one first
+struct SurfaceFormat {
+    SDL_PixelFormat pixelFormat{};
+    vk::Format format{};
+    PixelConversion conversion{};
+};
+
+constexpr std::array SURFACE_FORMATS{
+    SurfaceFormat{SDL_PIXELFORMAT_RGBA32, vk::Format::eR8G8B8A8Srgb, PixelConversion::None},
+    SurfaceFormat{SDL_PIXELFORMAT_BGRA32, vk::Format::eB8G8R8A8Srgb, PixelConversion::None},
+    SurfaceFormat{SDL_PIXELFORMAT_RGBX32, vk::Format::eR8G8B8A8Srgb, PixelConversion::FillOpaqueAlpha},
+    SurfaceFormat{SDL_PIXELFORMAT_BGRX32, vk::Format::eB8G8R8A8Srgb, PixelConversion::FillOpaqueAlpha},
+    SurfaceFormat{SDL_PIXELFORMAT_RGB24, vk::Format::eR8G8B8A8Srgb, PixelConversion::ExpandToOpaque},
+    SurfaceFormat{SDL_PIXELFORMAT_BGR24, vk::Format::eB8G8R8A8Srgb, PixelConversion::ExpandToOpaque},
+};
+
+constexpr std::array<uint8_t, 12> KTX2_IDENTIFIER{0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+// Loads a 2D KTX2 texture without supercompression, so BC7 or ASTC data can be copied to the GPU as is. Basis
+// Universal and Zstandard payloads would need transcoding on the CPU and are rejected.
+inline DecodedImage LoadKTX2(std::filesystem::path const &filename) {
+    std::ifstream file{filename, std::ios::binary | std::ios::ate};
+    if (!file)
+        throw std::runtime_error("Failed to open file");
+    DecodedImage image{};
+    image.fileData.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(image.fileData.data()), static_cast<std::streamsize>(image.fileData.size()));
+    if (!file)
+        throw std::runtime_error("Failed to read file");
+
+    KTX2Header header{};
+    if (image.fileData.size() < sizeof(header))
+        throw std::runtime_error("Truncated KTX2 header");
+    std::memcpy(&header, image.fileData.data(), sizeof(header));
+    if (header.identifier != KTX2_IDENTIFIER)
+        throw std::runtime_error("Not a KTX2 file");
+    image.format = static_cast<vk::Format>(header.vkFormat);
+    if (image.format == vk::Format::eUndefined || header.supercompressionScheme != 0)
+        throw std::runtime_error("Supercompressed KTX2 files are not supported");
+    if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 || header.layerCount > 1 ||
+        header.faceCount != 1)
+        throw std::runtime_error("Only 2D KTX2 textures are supported");
+
+    auto const block{GetFormatBlock(image.format)};
+    if (block.size == 0 || vk::planeCount(image.format) != 1)
+        throw std::runtime_error(std::format("Unsupported format {}", vk::to_string(image.format)));
+
+    auto const levelCount{std::max(header.levelCount, 1u)};
+    // a full mip chain ends at 1x1, more levels would shift the extent by 32 bits or more
+    if (levelCount > static_cast<uint32_t>(std::bit_width(std::max(header.pixelWidth, header.pixelHeight))))
+        throw std::runtime_error(std::format("Corrupt KTX2 header with {} levels", levelCount));
+    if (image.fileData.size() < sizeof(header) + levelCount * sizeof(KTX2LevelIndex))
+        throw std::runtime_error("Truncated KTX2 level index");
+    for (uint32_t level = 0; level < levelCount; level++) {
+        KTX2LevelIndex levelIndex{};
+        std::memcpy(&levelIndex, image.fileData.data() + sizeof(header) + level * sizeof(levelIndex),
+                    sizeof(levelIndex));
+        vk::Extent2D const extent{
+            std::max(header.pixelWidth >> level, 1u), std::max(header.pixelHeight >> level, 1u)
+        };
+        auto const rowPitch{static_cast<size_t>((extent.width + block.extent.width - 1) / block.extent.width) *
+                            block.size};
+        auto const rowCount{(extent.height + block.extent.height - 1) / block.extent.height};
+        if (levelIndex.byteLength != rowPitch * rowCount || levelIndex.byteOffset > image.fileData.size() ||
+            levelIndex.byteLength > image.fileData.size() - levelIndex.byteOffset)
+            throw std::runtime_error(std::format("Invalid KTX2 level {}", level));
+        image.levels.push_back(ImageLevel{extent, static_cast<size_t>(levelIndex.byteOffset), rowPitch});
+    }
+    image.mipLevels = levelCount;
+    return image;
+}
+
+// Decodes image files on worker threads. It only needs SDL_image, so decoding can start before the Vulkan device
+// exists and overlap instance and device creation. KTX2 files are read as they are, everything else is decoded by
+// SDL_image and gets a full mip chain to be generated on the GPU.
+class ImageDecoder {
+    struct DecodeRequest {
+        StreamTicket ticket{};
+        std::string filename{};
+    };
+
+    TraceRecorder *trace;
+    StreamTicket nextTicket{};
+
+    std::mutex mutex{};
+    std::condition_variable_any requestAvailable{};
+    std::deque<DecodeRequest> requests{};
+    std::vector<DecodedImage> decoded{};
+    std::vector<std::jthread> workers{};
+
+public:
+    explicit ImageDecoder(uint32_t const workerCount = 2, TraceRecorder *trace = nullptr) : trace{trace} {
+        for (uint32_t i = 0; i < workerCount; i++)
+            workers.emplace_back([this, i](std::stop_token const &stopToken) { DecodeLoop(stopToken, i); });
+    }
+
+    ~ImageDecoder() {
+        workers.clear();
+    }
+
+    ImageDecoder(ImageDecoder const &) = delete;
+    ImageDecoder &operator=(ImageDecoder const &) = delete;
+
+    StreamTicket Request(std::string filename) {
+        std::scoped_lock lock{mutex};
+        auto const ticket{nextTicket++};
+        requests.push_back({ticket, std::move(filename)});
+        requestAvailable.notify_one();
+        return ticket;
+    }
+
+    // Images decoded since the last call, images that failed to decode are logged and never show up
+    std::vector<DecodedImage> TakeDecoded() {
+        std::scoped_lock lock{mutex};
+        return std::exchange(decoded, {});
+    }
+
+    // Decodes a file on the calling thread, failures are logged and return nothing
+    static std::optional<DecodedImage> Decode(std::string const &filename) {
+        if (std::filesystem::path{filename}.extension() != ".ktx2")
+            return DecodeWithSDL(filename);
+        try {
+            return LoadKTX2(filename);
+        } catch (std::exception const &e) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to load image %s: %s", filename.c_str(), e.what());
+            return std::nullopt;
+        }
+    }
+
+private:
+    void DecodeLoop(std::stop_token const &stopToken, uint32_t const workerIndex) {
+        if (trace)
+            trace->SetThreadName(std::format("decode {}", workerIndex));
+
+        while (true) {
+            DecodeRequest request;
+            {
+                std::unique_lock lock{mutex};
+                if (!requestAvailable.wait(lock, stopToken, [this] { return !requests.empty(); }))
+                    return;
+                request = std::move(requests.front());
+                requests.pop_front();
+            }
+
+            TraceScope const scope{trace, std::format("Decode {}", request.filename)};
+            auto image{Decode(request.filename)};
+            if (!image)
+                continue;
+
+            image->ticket = request.ticket;
+            std::scoped_lock lock{mutex};
+            decoded.push_back(std::move(*image));
+        }
+    }
+
+    static std::optional<DecodedImage> DecodeWithSDL(std::string const &filename) {
+        auto surface{IMG_Load(filename.c_str())};
+        if (!surface) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to load image %s: %s", filename.c_str(),
+                         SDL_GetError());
+            return std::nullopt;
+        }
+
+        // Only uncommon formats such as palettized or 16 bit ones still get converted into a second surface
+        auto surfaceFormat{std::ranges::find(SURFACE_FORMATS, surface->format, &SurfaceFormat::pixelFormat)};
+        if (surfaceFormat == SURFACE_FORMATS.end()) {
+            auto const convertedSurface{SDL_ConvertSurface(surface, SDL_PIXELFORMAT_RGBA32)};
+            SDL_DestroySurface(surface);
+            surface = convertedSurface;
+            if (!surface) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to convert image %s: %s", filename.c_str(),
+                             SDL_GetError());
+                return std::nullopt;
+            }
+            surfaceFormat = SURFACE_FORMATS.begin();
+        }
+
+        DecodedImage image{};
+        image.format = surfaceFormat->format;
+        image.conversion = surfaceFormat->conversion;
+        vk::Extent2D const extent{static_cast<uint32_t>(surface->w), static_cast<uint32_t>(surface->h)};
+        image.levels.push_back(ImageLevel{extent, 0, static_cast<size_t>(surface->pitch)});
+        image.mipLevels = std::bit_width(std::max(extent.width, extent.height));
+        image.surface.reset(surface);
+        return image;
+    }
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+struct ImageLayout {
+    vk::ImageLayout imageLayout{};
+    vk::PipelineStageFlags2 stageMask{};
+    vk::AccessFlags2 accessMask{};
+    uint32_t queueFamilyIndex{VK_QUEUE_FAMILY_IGNORED};
+};
+
+inline void TransitionImageLayout(vk::raii::CommandBuffer const &commandBuffer, vk::Image const &image,
+                                  ImageLayout const &oldLayout, ImageLayout const &newLayout,
+                                  vk::ImageSubresourceRange const &range = {
+                                      vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1
+                                  }) {
+    vk::ImageMemoryBarrier2 const barrier{
+        oldLayout.stageMask,
+        oldLayout.accessMask,
+        newLayout.stageMask,
+        newLayout.accessMask,
+        oldLayout.imageLayout,
+        newLayout.imageLayout,
+        oldLayout.queueFamilyIndex,
+        newLayout.queueFamilyIndex,
+        image, range
+    };
+    vk::DependencyInfo dependencyInfo{};
+    dependencyInfo.setImageMemoryBarriers(barrier);
+    commandBuffer.pipelineBarrier2(dependencyInfo);
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Jobs each thread's queue holds before Submit() spills over into the other queues
+constexpr uint32_t JOB_QUEUE_CAPACITY{256};
+
+// Counts the jobs of a batch that have not finished yet, JobSystem::Wait blocks until it reaches zero
+class JobCounter {
+    friend class JobSystem;
+    std::atomic<uint32_t> pendingCount{};
+};
+
+// Work-stealing thread pool. Every thread owns a fixed ring of jobs, it pops its own jobs from the back and steals from
+// the front of the others when it runs dry, so neither submitting nor running a job touches the heap. Jobs receive the
+// index of the thread running them so they can use per-thread resources such as command pools; indices range over
+// [0, GetThreadCount()), the last one belongs to the thread calling Wait(), which helps with the work instead of
+// sleeping. Only one thread at a time may call Wait().
+class JobSystem {
+public:
+    // Non-owning callable invoked with an index chosen by the submitter and the index of the thread running it, so one
+    // callable can be shared by a whole batch. The callable has to outlive the Wait() on the job's counter.
+    class Job {
+        void const *callable{};
+        void (*invoke)(void const *callable, uint32_t index, uint32_t threadIndex){};
+        uint32_t index{};
+
+    public:
+        Job() = default;
+
+        template<typename Function>
+        Job(Function const &function, uint32_t const index)
+            : callable{&function}, invoke{
+                  [](void const *callable, uint32_t const index, uint32_t const threadIndex) {
+                      (*static_cast<Function const *>(callable))(index, threadIndex);
+                  }
+              }, index{index} {}
+
+        void operator()(uint32_t const threadIndex) const { invoke(callable, index, threadIndex); }
+    };
+
+private:
+    struct Task {
+        Job job{};
+        JobCounter *counter{};
+    };
+
+    struct WorkQueue {
+        std::mutex mutex{};
+        // tasks[(front + i) % JOB_QUEUE_CAPACITY] for i in [0, count)
+        std::array<Task, JOB_QUEUE_CAPACITY> tasks{};
+        uint32_t front{};
+        uint32_t count{};
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues{};
+    std::atomic<uint32_t> nextQueue{};
+    std::atomic<uint32_t> queuedCount{};
+    std::mutex sleepMutex{};
+    std::condition_variable_any jobAvailable{};
+    std::vector<std::jthread> workers{};
+
+public:
+    explicit JobSystem(uint32_t const workerCount) {
+        for (uint32_t i = 0; i <= workerCount; i++)
+            queues.push_back(std::make_unique<WorkQueue>());
+        for (uint32_t i = 0; i < workerCount; i++)
+            workers.emplace_back([this, i](std::stop_token const &stopToken) { WorkerLoop(stopToken, i); });
+    }
+
+    ~JobSystem() {
+        for (auto &worker: workers)
+            worker.request_stop();
+        jobAvailable.notify_all();
+    }
+
+    JobSystem(JobSystem const &) = delete;
+    JobSystem &operator=(JobSystem const &) = delete;
+
+    // Worker threads plus the thread calling Wait()
+    [[nodiscard]] uint32_t GetThreadCount() const { return static_cast<uint32_t>(queues.size()); }
+
+    // Has to be called from the thread calling Wait(), which runs the job right away when every queue is full
+    void Submit(JobCounter &counter, Job const job) {
+        counter.pendingCount.fetch_add(1, std::memory_order_relaxed);
+        // without workers the caller runs everything itself in Wait()
+        auto const queueIndex{workers.empty() ? 0 : nextQueue.fetch_add(1, std::memory_order_relaxed) % workers.size()};
+        auto pushed{false};
+        for (uint32_t i = 0; !pushed && i < queues.size(); i++)
+            pushed = TryPush((queueIndex + i) % queues.size(), Task{job, &counter});
+        if (!pushed) {
+            job(GetThreadCount() - 1);
+            counter.pendingCount.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        {
+            std::scoped_lock lock{sleepMutex};
+            queuedCount.fetch_add(1, std::memory_order_release);
+        }
+        jobAvailable.notify_one();
+    }
+
+    void Wait(JobCounter &counter) {
+        auto const callerIndex{GetThreadCount() - 1};
+        for (auto pendingCount{counter.pendingCount.load()}; pendingCount != 0;
+             pendingCount = counter.pendingCount.load())
+            if (!TryRunJob(callerIndex))
+                counter.pendingCount.wait(pendingCount);
+    }
+
+private:
+    void WorkerLoop(std::stop_token const &stopToken, uint32_t const threadIndex) {
+        while (!stopToken.stop_requested()) {
+            if (TryRunJob(threadIndex))
+                continue;
+            std::unique_lock lock{sleepMutex};
+            jobAvailable.wait(lock, stopToken, [this] { return queuedCount.load(std::memory_order_acquire) != 0; });
+        }
+    }
+
+    bool TryPush(uint32_t const queueIndex, Task const &task) {
+        auto &queue{*queues[queueIndex]};
+        std::scoped_lock lock{queue.mutex};
+        if (queue.count == JOB_QUEUE_CAPACITY)
+            return false;
+        queue.tasks[(queue.front + queue.count) % JOB_QUEUE_CAPACITY] = task;
+        queue.count++;
+        return true;
+    }
+
+    bool TryPop(uint32_t const queueIndex, bool const steal, Task &task) {
+        auto &queue{*queues[queueIndex]};
+        std::scoped_lock lock{queue.mutex};
+        if (queue.count == 0)
+            return false;
+        if (steal) {
+            task = queue.tasks[queue.front];
+            queue.front = (queue.front + 1) % JOB_QUEUE_CAPACITY;
+        } else
+            task = queue.tasks[(queue.front + queue.count - 1) % JOB_QUEUE_CAPACITY];
+        queue.count--;
+        return true;
+    }
+
+    bool TryRunJob(uint32_t const threadIndex) {
+        Task task{};
+        auto found{TryPop(threadIndex, false, task)};
+        for (uint32_t i = 1; !found && i < queues.size(); i++)
+            found = TryPop((threadIndex + i) % queues.size(), true, task);
+        if (!found)
+            return false;
+
+        queuedCount.fetch_sub(1, std::memory_order_relaxed);
+        task.job(threadIndex);
+        if (task.counter->pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            task.counter->pendingCount.notify_all();
+        return true;
+    }
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "vk_mem_alloc.h"
+
+// What an allocation is used for, the memory report breaks usage down by category
+enum class AllocationCategory {
+    Texture,
+    Staging,
+    RenderTarget,
+    // Buffers rewritten every frame, such as sprite instances
+    Dynamic,
+    // Buffers the device copies results into for the host to read
+    Readback,
+};
+
+constexpr std::array<std::string_view, 5> ALLOCATION_CATEGORY_NAMES{
+    "texture", "staging", "render_target", "dynamic", "readback"
+};
+
+// Heaps above this fraction of their budget are reported once, before the driver starts paging
+constexpr double MEMORY_BUDGET_WARNING_FRACTION{0.9};
+
+struct HeapBudget {
+    vk::MemoryHeapFlags flags{};
+    VmaBudget budget{};
+};
+
+class Allocator;
+
+// Image or buffer together with its memory, both are freed when the handle is destroyed or reset
+template<typename Handle>
+class AllocatedResource {
+    friend class Allocator;
+
+    Allocator *allocator{};
+    Handle handle{};
+    VmaAllocation allocation{};
+    AllocationCategory category{};
+    void *mappedData{};
+
+    AllocatedResource(Allocator *allocator, Handle const handle, VmaAllocation const allocation,
+                      AllocationCategory const category, void *mappedData)
+        : allocator{allocator}, handle{handle}, allocation{allocation}, category{category}, mappedData{mappedData} {}
+
+public:
+    AllocatedResource() = default;
+
+    AllocatedResource(AllocatedResource &&other) noexcept
+        : allocator{std::exchange(other.allocator, nullptr)}, handle{std::exchange(other.handle, {})},
+          allocation{std::exchange(other.allocation, nullptr)}, category{other.category},
+          mappedData{std::exchange(other.mappedData, nullptr)} {}
+
+    AllocatedResource &operator=(AllocatedResource &&other) noexcept {
+        if (this != &other) {
+            Reset();
+            allocator = std::exchange(other.allocator, nullptr);
+            handle = std::exchange(other.handle, {});
+            allocation = std::exchange(other.allocation, nullptr);
+            category = other.category;
+            mappedData = std::exchange(other.mappedData, nullptr);
+        }
+        return *this;
+    }
+
+    ~AllocatedResource() { Reset(); }
+
+    void Reset();
+
+    // Makes host writes to a non-coherent mapped range visible to the device
+    void Flush(vk::DeviceSize offset, vk::DeviceSize size) const;
+    // Makes device writes to a non-coherent mapped range visible to the host
+    void Invalidate(vk::DeviceSize offset, vk::DeviceSize size) const;
+
+    [[nodiscard]] Handle Get() const { return handle; }
+    // Host address of persistently mapped allocations, null otherwise
+    [[nodiscard]] void *GetMappedData() const { return mappedData; }
+    explicit operator bool() const { return allocation != nullptr; }
+};
+
+using AllocatedImage = AllocatedResource<vk::Image>;
+using AllocatedBuffer = AllocatedResource<vk::Buffer>;
+
+// VMA allocator handing out RAII resources tagged by category. Tracks live usage per category and reads per-heap usage
+// against the budget, which VK_EXT_memory_budget makes exact where the device supports it.
+class Allocator {
+    template<typename Handle> friend class AllocatedResource;
+
+    struct CategoryUsage {
+        std::atomic<uint64_t> allocationCount{};
+        std::atomic<uint64_t> bytes{};
+    };
+
+    VmaAllocator allocator{};
+    vk::PhysicalDeviceMemoryProperties memoryProperties{};
+    bool memoryBudgetEnabled{};
+    std::array<CategoryUsage, ALLOCATION_CATEGORY_NAMES.size()> categoryUsage{};
+    // Heaps that already crossed MEMORY_BUDGET_WARNING_FRACTION, one bit per heap
+    std::atomic<uint32_t> warnedHeaps{};
+
+public:
+    Allocator(vk::raii::Instance const &instance, vk::raii::PhysicalDevice const &physicalDevice,
+              vk::raii::Device const &device, uint32_t const vulkanApiVersion, bool const memoryBudgetEnabled)
+        : memoryProperties{physicalDevice.getMemoryProperties()}, memoryBudgetEnabled{memoryBudgetEnabled} {
+        VmaAllocatorCreateInfo allocatorCreateInfo{};
+        allocatorCreateInfo.physicalDevice = *physicalDevice;
+        allocatorCreateInfo.device = *device;
+        allocatorCreateInfo.instance = *instance;
+        allocatorCreateInfo.vulkanApiVersion = vulkanApiVersion;
+        if (memoryBudgetEnabled)
+            allocatorCreateInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+        VmaVulkanFunctions const functions{
+            .vkGetInstanceProcAddr = instance.getDispatcher()->vkGetInstanceProcAddr,
+            .vkGetDeviceProcAddr = device.getDispatcher()->vkGetDeviceProcAddr,
+        };
+        allocatorCreateInfo.pVulkanFunctions = &functions;
+        if (vmaCreateAllocator(&allocatorCreateInfo, &allocator) != VK_SUCCESS)
+            throw std::runtime_error("Failed to create allocator");
+    }
+
+    ~Allocator() { vmaDestroyAllocator(allocator); }
+
+    Allocator(Allocator const &) = delete;
+    Allocator &operator=(Allocator const &) = delete;
+
+    [[nodiscard]] VmaAllocator Get() const { return allocator; }
+
+    AllocatedImage CreateImage(vk::ImageCreateInfo const &imageCreateInfo,
+                               VmaAllocationCreateInfo const &allocationCreateInfo,
+                               AllocationCategory const category) {
+        auto const rawImageCreateInfo{static_cast<VkImageCreateInfo>(imageCreateInfo)};
+        VkImage image;
+        VmaAllocation allocation;
+        VmaAllocationInfo allocationInfo{};
+        if (vmaCreateImage(allocator, &rawImageCreateInfo, &allocationCreateInfo, &image, &allocation,
+                           &allocationInfo) != VK_SUCCESS)
+            throw std::runtime_error(std::format("Failed to create {} image", GetCategoryName(category)));
+        Track(allocation, allocationInfo, category);
+        return AllocatedImage{this, vk::Image{image}, allocation, category, nullptr};
+    }
+
+    AllocatedBuffer CreateBuffer(vk::BufferCreateInfo const &bufferCreateInfo,
+                                 VmaAllocationCreateInfo const &allocationCreateInfo,
+                                 AllocationCategory const category) {
+        auto const rawBufferCreateInfo{static_cast<VkBufferCreateInfo>(bufferCreateInfo)};
+        VkBuffer buffer;
+        VmaAllocation allocation;
+        VmaAllocationInfo allocationInfo{};
+        if (vmaCreateBuffer(allocator, &rawBufferCreateInfo, &allocationCreateInfo, &buffer, &allocation,
+                            &allocationInfo) != VK_SUCCESS)
+            throw std::runtime_error(std::format("Failed to create {} buffer", GetCategoryName(category)));
+        Track(allocation, allocationInfo, category);
+        return AllocatedBuffer{this, vk::Buffer{buffer}, allocation, category, allocationInfo.pMappedData};
+    }
+
+    // Usage and budget of every memory heap, cheap enough to call once per frame
+    [[nodiscard]] std::vector<HeapBudget> GetHeapBudgets() const {
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(allocator, budgets.data());
+        std::vector<HeapBudget> heapBudgets{};
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+            heapBudgets.push_back(HeapBudget{memoryProperties.memoryHeaps[i].flags, budgets[i]});
+        return heapBudgets;
+    }
+
+    // Writes budgets, per-category usage and VMA's detailed statistics as JSON, returns false on failure
+    bool WriteReport(std::filesystem::path const &filename) const {
+        std::ofstream output{filename};
+        if (!output)
+            return false;
+
+        VmaTotalStatistics statistics{};
+        vmaCalculateStatistics(allocator, &statistics);
+        auto const heapBudgets{GetHeapBudgets()};
+
+        std::println(output, "{{");
+        std::println(output, R"(  "memory_budget_extension": {},)", memoryBudgetEnabled);
+        std::println(output, R"(  "heaps": [)");
+        for (uint32_t i = 0; i < heapBudgets.size(); i++) {
+            auto const &[flags, budget]{heapBudgets[i]};
+            auto const &heapStatistics{statistics.memoryHeap[i].statistics};
+            std::println(output, R"(    {{"index": {}, "device_local": {}, "size": {}, "budget": {}, "usage": {}, )"
+                         R"("block_bytes": {}, "allocation_bytes": {}, "block_count": {}, "allocation_count": {}}}{})",
+                         i, static_cast<bool>(flags & vk::MemoryHeapFlagBits::eDeviceLocal),
+                         memoryProperties.memoryHeaps[i].size, budget.budget, budget.usage,
+                         heapStatistics.blockBytes, heapStatistics.allocationBytes, heapStatistics.blockCount,
+                         heapStatistics.allocationCount, i + 1 == heapBudgets.size() ? "" : ",");
+        }
+        std::println(output, "  ],");
+        std::println(output, R"(  "categories": {{)");
+        for (size_t i = 0; i < categoryUsage.size(); i++)
+            std::println(output, R"(    "{}": {{"allocation_count": {}, "bytes": {}}}{})",
+                         ALLOCATION_CATEGORY_NAMES[i], categoryUsage[i].allocationCount.load(),
+                         categoryUsage[i].bytes.load(), i + 1 == categoryUsage.size() ? "" : ",");
+        std::println(output, "  }},");
+
+        char *detailedStatistics{};
+        vmaBuildStatsString(allocator, &detailedStatistics, VK_TRUE);
+        std::println(output, R"(  "vma": {})", detailedStatistics);
+        vmaFreeStatsString(allocator, detailedStatistics);
+        std::println(output, "}}");
+        return static_cast<bool>(output);
+    }
+
+private:
+    static std::string_view GetCategoryName(AllocationCategory const category) {
+        return ALLOCATION_CATEGORY_NAMES[static_cast<size_t>(category)];
+    }
+
+    void Track(VmaAllocation const allocation, VmaAllocationInfo const &allocationInfo,
+               AllocationCategory const category) {
+        vmaSetAllocationName(allocator, allocation, GetCategoryName(category).data());
+        auto &usage{categoryUsage[static_cast<size_t>(category)]};
+        usage.allocationCount.fetch_add(1, std::memory_order_relaxed);
+        usage.bytes.fetch_add(allocationInfo.size, std::memory_order_relaxed);
+
+        auto const heapIndex{memoryProperties.memoryTypes[allocationInfo.memoryType].heapIndex};
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(allocator, budgets.data());
+        auto const &budget{budgets[heapIndex]};
+        if (static_cast<double>(budget.usage) < MEMORY_BUDGET_WARNING_FRACTION * static_cast<double>(budget.budget))
+            return;
+        if (warnedHeaps.fetch_or(1u << heapIndex, std::memory_order_relaxed) & 1u << heapIndex)
+            return;
+        std::println("Warning: memory heap {} uses {} of its {} byte budget", heapIndex, budget.usage, budget.budget);
+    }
+
+    void Free(VmaAllocation const allocation, AllocationCategory const category) {
+        VmaAllocationInfo allocationInfo{};
+        vmaGetAllocationInfo(allocator, allocation, &allocationInfo);
+        auto &usage{categoryUsage[static_cast<size_t>(category)]};
+        usage.allocationCount.fetch_sub(1, std::memory_order_relaxed);
+        usage.bytes.fetch_sub(allocationInfo.size, std::memory_order_relaxed);
+    }
+};
+
+template<typename Handle>
+void AllocatedResource<Handle>::Reset() {
+    if (!allocation)
+        return;
+    allocator->Free(allocation, category);
+    if constexpr (std::is_same_v<Handle, vk::Image>)
+        vmaDestroyImage(allocator->Get(), handle, allocation);
+    else
+        vmaDestroyBuffer(allocator->Get(), handle, allocation);
+    allocator = nullptr;
+    handle = Handle{};
+    allocation = nullptr;
+    mappedData = nullptr;
+}
+
+template<typename Handle>
+void AllocatedResource<Handle>::Flush(vk::DeviceSize const offset, vk::DeviceSize const size) const {
+    vmaFlushAllocation(allocator->Get(), allocation, offset, size);
+}
+
+template<typename Handle>
+void AllocatedResource<Handle>::Invalidate(vk::DeviceSize const offset, vk::DeviceSize const size) const {
+    vmaInvalidateAllocation(allocator->Get(), allocation, offset, size);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+inline std::vector<char> ReadBinaryFile(std::filesystem::path const &filename) {
+    std::ifstream file{filename, std::ios::binary | std::ios::ate};
+    if (!file)
+        return {};
+    std::vector<char> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), static_cast<std::streamsize>(data.size()));
+    return data;
+}
+
+inline vk::raii::ShaderModule LoadShaderModule(vk::raii::Device const &device, std::filesystem::path const &filename) {
+    auto const code{ReadBinaryFile(filename)};
+    if (code.empty() || code.size() % sizeof(uint32_t) != 0)
+        throw std::runtime_error(std::format("Failed to load shader: {}", filename.string()));
+
+    vk::ShaderModuleCreateInfo shaderModuleCreateInfo{};
+    shaderModuleCreateInfo.codeSize = code.size();
+    shaderModuleCreateInfo.pCode = reinterpret_cast<uint32_t const *>(code.data());
+    return vk::raii::ShaderModule{device, shaderModuleCreateInfo};
+}
+
+// Prefix of the pipeline cache file, the driver's data is only used when every field matches the running device
+struct PipelineCacheFileHeader {
+    static constexpr uint32_t MAGIC{0x43505643}; // "CVPC"
+    static constexpr uint32_t VERSION{1};
+
+    uint32_t magic{};
+    uint32_t version{};
+    uint32_t vendorID{};
+    uint32_t deviceID{};
+    uint32_t driverVersion{};
+    uint32_t apiVersion{};
+    std::array<uint8_t, VK_UUID_SIZE> deviceUUID{};
+    std::array<uint8_t, VK_UUID_SIZE> pipelineCacheUUID{};
+    uint64_t dataSize{};
+    uint64_t dataHash{};
+
+    bool operator==(PipelineCacheFileHeader const &) const = default;
+};
+
+// FNV-1a, only guards against truncated or corrupted files
+inline uint64_t HashBytes(std::span<char const> const bytes) {
+    uint64_t hash{0xcbf29ce484222325};
+    for (auto const byte: bytes)
+        hash = (hash ^ static_cast<uint8_t>(byte)) * 0x100000001b3;
+    return hash;
+}
+
+// Pipeline cache backed by a file, loaded on construction and written back by Save(). The file is keyed by the device
+// UUID and driver version, data written by another device or driver is discarded instead of being handed to the driver.
+class PersistentPipelineCache {
+    std::filesystem::path filename;
+    PipelineCacheFileHeader key{};
+    vk::raii::PipelineCache pipelineCache{nullptr};
+    bool loaded{};
+
+public:
+    PersistentPipelineCache(vk::raii::PhysicalDevice const &physicalDevice, vk::raii::Device const &device,
+                            std::filesystem::path filename)
+        : filename{std::move(filename)} {
+        auto const propertiesChain{
+            physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>()
+        };
+        auto const &properties{propertiesChain.get<vk::PhysicalDeviceProperties2>().properties};
+        key.magic = PipelineCacheFileHeader::MAGIC;
+        key.version = PipelineCacheFileHeader::VERSION;
+        key.vendorID = properties.vendorID;
+        key.deviceID = properties.deviceID;
+        key.driverVersion = properties.driverVersion;
+        key.apiVersion = properties.apiVersion;
+        key.deviceUUID = propertiesChain.get<vk::PhysicalDeviceIDProperties>().deviceUUID;
+        key.pipelineCacheUUID = properties.pipelineCacheUUID;
+
+        auto const file{ReadBinaryFile(this->filename)};
+        std::span<char const> initialData{};
+        if (!file.empty()) {
+            if (auto const error{Validate(file)})
+                std::println("Discarding pipeline cache {}: {}", this->filename.string(), error);
+            else
+                initialData = std::span{file}.subspan(sizeof(PipelineCacheFileHeader));
+        }
+        loaded = !initialData.empty();
+
+        vk::PipelineCacheCreateInfo pipelineCacheCreateInfo{};
+        pipelineCacheCreateInfo.initialDataSize = initialData.size();
+        pipelineCacheCreateInfo.pInitialData = initialData.data();
+        pipelineCache = vk::raii::PipelineCache{device, pipelineCacheCreateInfo};
+    }
+
+    // Writes to a temporary file first so an interrupted save never leaves a truncated cache behind
+    void Save() const {
+        auto const data{pipelineCache.getData()};
+        auto header{key};
+        header.dataSize = data.size();
+        header.dataHash = HashBytes({reinterpret_cast<char const *>(data.data()), data.size()});
+
+        auto temporaryFilename{filename};
+        temporaryFilename += ".tmp";
+        {
+            std::ofstream file{temporaryFilename, std::ios::binary | std::ios::trunc};
+            file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            file.write(reinterpret_cast<char const *>(data.data()), static_cast<std::streamsize>(data.size()));
+            if (!file) {
+                std::println("Failed to write pipeline cache {}", temporaryFilename.string());
+                return;
+            }
+        }
+        std::error_code error{};
+        std::filesystem::rename(temporaryFilename, filename, error);
+        if (error)
+            std::println("Failed to write pipeline cache {}: {}", filename.string(), error.message());
+    }
+
+    [[nodiscard]] vk::raii::PipelineCache const &Get() const { return pipelineCache; }
+
+    // Whether the cache was seeded from a valid file, pipelines created from it should skip compilation
+    [[nodiscard]] bool IsWarm() const { return loaded; }
+
+private:
+    [[nodiscard]] char const *Validate(std::span<char const> const file) const {
+        if (file.size() < sizeof(PipelineCacheFileHeader))
+            return "truncated header";
+        PipelineCacheFileHeader header{};
+        std::memcpy(&header, file.data(), sizeof(header));
+        auto const data{file.subspan(sizeof(header))};
+        if (header.magic != key.magic || header.version != key.version)
+            return "unknown format";
+        if (header.dataSize != data.size() || header.dataHash != HashBytes(data))
+            return "corrupted data";
+        header.dataSize = {};
+        header.dataHash = {};
+        if (header != key)
+            return "written by another device or driver";
+        return nullptr;
+    }
+};
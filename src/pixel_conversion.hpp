@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// What turns the bytes of a decoded row into texels of the image format while the row is copied to staging memory.
+// Decoded images get a format with their byte order, so no conversion ever has to reorder channels.
+enum class PixelConversion {
+    // The bytes are the texels
+    None,
+    // 3 byte pixels, expanded to 4 bytes with an opaque alpha
+    ExpandToOpaque,
+    // 4 byte pixels whose unused fourth byte becomes an opaque alpha
+    FillOpaqueAlpha,
+};
+
+// Writes destinationSize bytes of texels to destination, 4 bytes per pixel unless conversion is None
+inline void ConvertPixels(std::byte *const destination, std::byte const *const source, size_t const destinationSize,
+                          PixelConversion const conversion) {
+    if (conversion == PixelConversion::None) {
+        std::memcpy(destination, source, destinationSize);
+        return;
+    }
+
+    auto const pixelCount{destinationSize / 4};
+    size_t i{};
+    if (conversion == PixelConversion::ExpandToOpaque) {
+#if defined(__ARM_NEON)
+        for (; i + 16 <= pixelCount; i += 16) {
+            auto const pixels{vld3q_u8(reinterpret_cast<uint8_t const *>(source + i * 3))};
+            uint8x16x4_t const texels{{pixels.val[0], pixels.val[1], pixels.val[2], vdupq_n_u8(0xFF)}};
+            vst4q_u8(reinterpret_cast<uint8_t *>(destination + i * 4), texels);
+        }
+#elif defined(__SSSE3__)
+        auto const shuffle{_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1)};
+        auto const alpha{_mm_set1_epi32(static_cast<int>(0xFF000000))};
+        // every load reads 16 bytes for 4 pixels, stop before it would read past the row
+        for (; i + 6 <= pixelCount; i += 4) {
+            auto const pixels{_mm_loadu_si128(reinterpret_cast<__m128i const *>(source + i * 3))};
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i * 4),
+                             _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+        }
+#endif
+        for (; i < pixelCount; i++) {
+            std::memcpy(destination + i * 4, source + i * 3, 3);
+            destination[i * 4 + 3] = std::byte{0xFF};
+        }
+        return;
+    }
+
+#if defined(__ARM_NEON)
+    auto const alpha{vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000))};
+    for (; i + 4 <= pixelCount; i += 4)
+        vst1q_u8(reinterpret_cast<uint8_t *>(destination + i * 4),
+                 vorrq_u8(vld1q_u8(reinterpret_cast<uint8_t const *>(source + i * 4)), alpha));
+#elif defined(__SSE2__) || defined(_M_X64)
+    auto const alpha{_mm_set1_epi32(static_cast<int>(0xFF000000))};
+    for (; i + 4 <= pixelCount; i += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i * 4),
+                         _mm_or_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(source + i * 4)), alpha));
+#endif
+    for (; i < pixelCount; i++) {
+        std::memcpy(destination + i * 4, source + i * 4, 3);
+        destination[i * 4 + 3] = std::byte{0xFF};
+    }
+}
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "image_layout.hpp"
+#include "memory.hpp"
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "render_graph.hpp"
+
+// Linear result of the post pass, blitted into the sRGB target which encodes it
+constexpr vk::Format POST_RESULT_FORMAT{vk::Format::eR16G16B16A16Sfloat};
+
+// Result of a frame's post pass, presented by the next frame
+struct PostOutput {
+    vk::Image image{};
+    vk::Extent2D extent{};
+    // Compute timeline value signaled once the image has been written
+    uint64_t timelineValue{};
+};
+
+// Post-processing on the async compute queue. A frame renders its scene into the slot's scene image and releases it
+// to the compute queue, which grades it into the slot's result image and releases that back. The next frame blits the
+// result into its target at the end of its graphics work, so the compute work of frame N runs next to the graphics
+// work of frame N + 1 at the cost of one frame of latency. When the compute family is the graphics family it is the
+// same pipeline on one queue, without ownership transfers and without the overlap.
+class PostProcessor {
+    static constexpr uint32_t GROUP_SIZE{8};
+
+    struct Targets {
+        vk::Extent2D extent{};
+        AllocatedImage scene{};
+        vk::raii::ImageView sceneView{nullptr};
+        AllocatedImage result{};
+        vk::raii::ImageView resultView{nullptr};
+    };
+
+    struct RetiredTargets {
+        Targets targets;
+        // Frame timeline value of the last submission that read them
+        uint64_t retireValue{};
+    };
+
+    struct Slot {
+        vk::raii::CommandPool commandPool;
+        vk::raii::CommandBuffer commandBuffer;
+        vk::raii::DescriptorSet descriptorSet;
+        // null when the compute queue has no timestamps
+        std::unique_ptr<GpuZoneQueries> gpuZones;
+        Targets targets{};
+    };
+
+    vk::raii::Device const &device;
+    Allocator &allocator;
+    vk::raii::Queue const &computeQueue;
+    vk::Format sceneFormat;
+    uint32_t graphicsQueueFamilyIndex;
+    uint32_t computeQueueFamilyIndex;
+
+    vk::raii::DescriptorSetLayout descriptorSetLayout{nullptr};
+    vk::raii::DescriptorPool descriptorPool{nullptr};
+    vk::raii::PipelineLayout pipelineLayout{nullptr};
+    vk::raii::Pipeline pipeline{nullptr};
+    vk::raii::Sampler sampler{nullptr};
+    // The compute queue's own timeline, frame N signals value N
+    vk::raii::Semaphore timeline{nullptr};
+    std::vector<Slot> slots{};
+    std::deque<RetiredTargets> retired{};
+
+public:
+    // computeQueue has to be of computeQueueFamilyIndex, which may be graphicsQueueFamilyIndex. timestampPeriod is
+    // only used when timestamps is true.
+    PostProcessor(vk::raii::Device const &device, Allocator &allocator, PersistentPipelineCache const &pipelineCache,
+                  vk::Format const sceneFormat, uint32_t const frameSlotCount,
+                  uint32_t const graphicsQueueFamilyIndex, vk::raii::Queue const &computeQueue,
+                  uint32_t const computeQueueFamilyIndex, bool const timestamps, double const timestampPeriod)
+        : device{device}, allocator{allocator}, computeQueue{computeQueue}, sceneFormat{sceneFormat},
+          graphicsQueueFamilyIndex{graphicsQueueFamilyIndex}, computeQueueFamilyIndex{computeQueueFamilyIndex} {
+        std::array const bindings{
+            vk::DescriptorSetLayoutBinding{
+                0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute
+            },
+            vk::DescriptorSetLayoutBinding{1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        };
+        vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+        descriptorSetLayoutCreateInfo.setBindings(bindings);
+        descriptorSetLayout = vk::raii::DescriptorSetLayout{device, descriptorSetLayoutCreateInfo};
+
+        // vk::raii::DescriptorSet frees itself, which needs eFreeDescriptorSet
+        std::array const poolSizes{
+            vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, frameSlotCount},
+            vk::DescriptorPoolSize{vk::DescriptorType::eStorageImage, frameSlotCount},
+        };
+        vk::DescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+        descriptorPoolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+        descriptorPoolCreateInfo.maxSets = frameSlotCount;
+        descriptorPoolCreateInfo.setPoolSizes(poolSizes);
+        descriptorPool = vk::raii::DescriptorPool{device, descriptorPoolCreateInfo};
+
+        vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.setSetLayouts(*descriptorSetLayout);
+        pipelineLayout = vk::raii::PipelineLayout{device, pipelineLayoutCreateInfo};
+
+        auto const shaderModule{LoadShaderModule(device, SHADERS_PATH "post.comp.spv")};
+        vk::ComputePipelineCreateInfo pipelineCreateInfo{};
+        pipelineCreateInfo.stage = vk::PipelineShaderStageCreateInfo{
+            {}, vk::ShaderStageFlagBits::eCompute, *shaderModule, "main"
+        };
+        pipelineCreateInfo.layout = *pipelineLayout;
+        pipeline = vk::raii::Pipeline{device, pipelineCache.Get(), pipelineCreateInfo};
+
+        // the scene is read texel by texel, the sampler only decodes sRGB
+        vk::SamplerCreateInfo samplerCreateInfo{};
+        samplerCreateInfo.magFilter = vk::Filter::eNearest;
+        samplerCreateInfo.minFilter = vk::Filter::eNearest;
+        samplerCreateInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+        samplerCreateInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+        samplerCreateInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+        sampler = vk::raii::Sampler{device, samplerCreateInfo};
+
+        vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> semaphoreCreateInfo{
+            {}, vk::SemaphoreTypeCreateInfo{vk::SemaphoreType::eTimeline, 0}
+        };
+        timeline = vk::raii::Semaphore{device, semaphoreCreateInfo.get<vk::SemaphoreCreateInfo>()};
+
+        vk::CommandPoolCreateInfo commandPoolCreateInfo{};
+        commandPoolCreateInfo.queueFamilyIndex = computeQueueFamilyIndex;
+        commandPoolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+        for (uint32_t i = 0; i < frameSlotCount; i++) {
+            vk::raii::CommandPool commandPool{device, commandPoolCreateInfo};
+            vk::CommandBufferAllocateInfo commandBufferAllocateInfo{};
+            commandBufferAllocateInfo.commandPool = *commandPool;
+            commandBufferAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+            commandBufferAllocateInfo.commandBufferCount = 1;
+            auto commandBuffer{std::move(device.allocateCommandBuffers(commandBufferAllocateInfo).front())};
+
+            vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+            descriptorSetAllocateInfo.descriptorPool = *descriptorPool;
+            descriptorSetAllocateInfo.setSetLayouts(*descriptorSetLayout);
+            auto descriptorSet{std::move(device.allocateDescriptorSets(descriptorSetAllocateInfo).front())};
+
+            slots.push_back(Slot{
+                std::move(commandPool), std::move(commandBuffer), std::move(descriptorSet),
+                timestamps
+                    ? std::make_unique<GpuZoneQueries>(device, timestampPeriod, false, GPU_COMPUTE_THREAD_INDEX)
+                    : nullptr
+            });
+        }
+    }
+
+    PostProcessor(PostProcessor const &) = delete;
+    PostProcessor &operator=(PostProcessor const &) = delete;
+
+    [[nodiscard]] bool IsAsync() const { return computeQueueFamilyIndex != graphicsQueueFamilyIndex; }
+    [[nodiscard]] vk::Semaphore GetTimeline() const { return *timeline; }
+    [[nodiscard]] uint64_t GetCompletedValue() const { return timeline.getCounterValue(); }
+
+    // Starts a frame on the slot, its previous compute submission has to have completed. Its images are recreated
+    // when the extent changed; the old ones stay alive until the frame timeline reaches retireValue, the value of the
+    // frame presenting the slot's last result. completedValue is the frame timeline's current value.
+    void BeginFrame(uint32_t const frameSlot, vk::Extent2D const extent, uint64_t const retireValue,
+                    uint64_t const completedValue) {
+        while (!retired.empty() && retired.front().retireValue <= completedValue)
+            retired.pop_front();
+        auto &slot{slots[frameSlot]};
+        slot.commandPool.reset();
+        if (slot.targets.extent == extent)
+            return;
+        if (slot.targets.scene)
+            retired.push_back(RetiredTargets{std::move(slot.targets), retireValue});
+        slot.targets = CreateTargets(extent);
+        UpdateDescriptorSet(slot);
+    }
+
+    // Hands the slot's compute zones to the profiler, only valid once its previous compute submission has completed
+    void ReadZones(uint32_t const frameSlot, Profiler &profiler) const {
+        if (auto const &gpuZones{slots[frameSlot].gpuZones})
+            gpuZones->Read(profiler);
+    }
+
+    // Image the frame's passes render the scene into, in place of the target
+    [[nodiscard]] vk::ImageView GetSceneImageView(uint32_t const frameSlot) const {
+        return *slots[frameSlot].targets.sceneView;
+    }
+
+    // Imports the slot's scene image into the frame's graph, its content is discarded and it is released to the
+    // compute queue after the last pass
+    RenderGraph::ImageHandle ImportScene(RenderGraph &renderGraph, uint32_t const frameSlot) const {
+        auto const scene{
+            renderGraph.ImportImage(slots[frameSlot].targets.scene.Get(), ImageLayout{vk::ImageLayout::eUndefined})
+        };
+        renderGraph.SetFinalUsage(scene, ResourceUsage::SampledCompute, GraphicsFamily(), ComputeFamily());
+        return scene;
+    }
+
+    // Adds the pass writing the previous frame's result into target, scaled if the extent changed since. Without a
+    // result yet the target is cleared. The submission has to wait for GetBlitWait(output).
+    void AddPresentPass(RenderGraph &renderGraph, RenderGraph::ImageHandle const target, vk::Image const targetImage,
+                        vk::Extent2D const targetExtent, std::optional<PostOutput> const &output) const {
+        if (!output) {
+            std::array const accesses{RenderGraph::ImageAccess{target, ResourceUsage::TransferDst}};
+            renderGraph.AddPass("post clear", accesses, [targetImage](vk::raii::CommandBuffer const &commandBuffer) {
+                commandBuffer.clearColorImage(targetImage, vk::ImageLayout::eTransferDstOptimal,
+                                              vk::ClearColorValue{std::array{0.0f, 0.0f, 0.0f, 1.0f}},
+                                              vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+            });
+            return;
+        }
+
+        // the compute queue released it in the transfer layout, an ownership transfer still has to be acquired
+        if (IsAsync())
+            renderGraph.AddExternalBarrier(vk::ImageMemoryBarrier2{
+                vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eNone,
+                vk::PipelineStageFlagBits2::eBlit, vk::AccessFlagBits2::eTransferRead,
+                vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal,
+                computeQueueFamilyIndex, graphicsQueueFamilyIndex,
+                output->image, vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}
+            });
+        auto const result{
+            renderGraph.ImportImage(output->image, ImageLayout{vk::ImageLayout::eTransferSrcOptimal})
+        };
+        std::array const accesses{
+            RenderGraph::ImageAccess{result, ResourceUsage::TransferSrc},
+            RenderGraph::ImageAccess{target, ResourceUsage::TransferDst},
+        };
+        renderGraph.AddPass("post blit", accesses,
+                            [source{output->image}, sourceExtent{output->extent}, targetImage, targetExtent](
+                        vk::raii::CommandBuffer const &commandBuffer) {
+                                vk::ImageBlit2 region{};
+                                region.srcSubresource = vk::ImageSubresourceLayers{
+                                    vk::ImageAspectFlagBits::eColor, 0, 0, 1
+                                };
+                                region.srcOffsets[1] = vk::Offset3D{
+                                    static_cast<int32_t>(sourceExtent.width),
+                                    static_cast<int32_t>(sourceExtent.height), 1
+                                };
+                                region.dstSubresource = region.srcSubresource;
+                                region.dstOffsets[1] = vk::Offset3D{
+                                    static_cast<int32_t>(targetExtent.width),
+                                    static_cast<int32_t>(targetExtent.height), 1
+                                };
+                                vk::BlitImageInfo2 blitInfo{};
+                                blitInfo.srcImage = source;
+                                blitInfo.srcImageLayout = vk::ImageLayout::eTransferSrcOptimal;
+                                blitInfo.dstImage = targetImage;
+                                blitInfo.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
+                                blitInfo.setRegions(region);
+                                blitInfo.filter = vk::Filter::eLinear;
+                                commandBuffer.blitImage2(blitInfo);
+                            });
+    }
+
+    // Only the blit waits, everything before it in the frame overlaps the compute work
+    [[nodiscard]] vk::SemaphoreSubmitInfo GetBlitWait(PostOutput const &output) const {
+        return vk::SemaphoreSubmitInfo{*timeline, output.timelineValue, vk::PipelineStageFlagBits2::eBlit};
+    }
+
+    // Records and submits the slot's post pass once the frame's graphics submission, which signals frameValue on
+    // frameTimeline, has been submitted. The result is presented by the next frame. submitTime places the GPU zones.
+    PostOutput Submit(uint32_t const frameSlot, vk::Semaphore const frameTimeline, uint64_t const frameValue,
+                      int64_t const submitTime) {
+        auto &slot{slots[frameSlot]};
+        auto const &commandBuffer{slot.commandBuffer};
+        vk::CommandBufferBeginInfo beginInfo{};
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        commandBuffer.begin(beginInfo);
+
+        uint32_t zone{};
+        if (slot.gpuZones) {
+            slot.gpuZones->Reset(commandBuffer, frameValue);
+            zone = slot.gpuZones->BeginZone(commandBuffer, "post", 0);
+        }
+
+        // the graphics queue released the scene already transitioned, this only acquires it
+        auto const &targets{slot.targets};
+        if (IsAsync())
+            TransitionImageLayout(commandBuffer, targets.scene.Get(),
+                                  ImageLayout{
+                                      vk::ImageLayout::eColorAttachmentOptimal,
+                                      vk::PipelineStageFlagBits2::eComputeShader,
+                                      vk::AccessFlagBits2::eNone,
+                                      graphicsQueueFamilyIndex,
+                                  },
+                                  ImageLayout{
+                                      vk::ImageLayout::eShaderReadOnlyOptimal,
+                                      vk::PipelineStageFlagBits2::eComputeShader,
+                                      vk::AccessFlagBits2::eShaderSampledRead,
+                                      computeQueueFamilyIndex,
+                                  });
+        // the last read of the result was by a frame the graphics submission waited for, its content is discarded
+        TransitionImageLayout(commandBuffer, targets.result.Get(),
+                              ImageLayout{vk::ImageLayout::eUndefined},
+                              ImageLayout{
+                                  vk::ImageLayout::eGeneral,
+                                  vk::PipelineStageFlagBits2::eComputeShader,
+                                  vk::AccessFlagBits2::eShaderStorageWrite,
+                              });
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipelineLayout, 0, *slot.descriptorSet, {});
+        commandBuffer.dispatch((targets.extent.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                               (targets.extent.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+
+        // released to the graphics queue in the layout the blit reads it in
+        TransitionImageLayout(commandBuffer, targets.result.Get(),
+                              ImageLayout{
+                                  vk::ImageLayout::eGeneral,
+                                  vk::PipelineStageFlagBits2::eComputeShader,
+                                  vk::AccessFlagBits2::eShaderStorageWrite,
+                                  ComputeFamily(),
+                              },
+                              ImageLayout{vk::ImageLayout::eTransferSrcOptimal, {}, {}, GraphicsFamily()});
+
+        if (slot.gpuZones)
+            slot.gpuZones->EndZone(commandBuffer, zone);
+        commandBuffer.end();
+
+        vk::CommandBufferSubmitInfo const commandBufferSubmitInfo{*commandBuffer};
+        vk::SemaphoreSubmitInfo const waitSemaphoreInfo{
+            frameTimeline, frameValue, vk::PipelineStageFlagBits2::eComputeShader
+        };
+        vk::SemaphoreSubmitInfo const signalSemaphoreInfo{
+            *timeline, frameValue, vk::PipelineStageFlagBits2::eAllCommands
+        };
+        vk::SubmitInfo2 submitInfo{};
+        submitInfo.setCommandBufferInfos(commandBufferSubmitInfo);
+        submitInfo.setWaitSemaphoreInfos(waitSemaphoreInfo);
+        submitInfo.setSignalSemaphoreInfos(signalSemaphoreInfo);
+        if (slot.gpuZones)
+            slot.gpuZones->MarkSubmitted(submitTime);
+        computeQueue.submit2(submitInfo);
+        return PostOutput{targets.result.Get(), targets.extent, frameValue};
+    }
+
+private:
+    // Queue families for ownership transfers, ignored on a single family where the barriers are plain transitions
+    [[nodiscard]] uint32_t GraphicsFamily() const {
+        return IsAsync() ? graphicsQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    [[nodiscard]] uint32_t ComputeFamily() const {
+        return IsAsync() ? computeQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    [[nodiscard]] Targets CreateTargets(vk::Extent2D const extent) const {
+        Targets targets{};
+        targets.extent = extent;
+
+        vk::ImageCreateInfo imageCreateInfo{};
+        imageCreateInfo.imageType = vk::ImageType::e2D;
+        imageCreateInfo.extent = vk::Extent3D{extent.width, extent.height, 1};
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+        imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+        imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        imageCreateInfo.format = sceneFormat;
+        imageCreateInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled;
+        targets.scene = allocator.CreateImage(imageCreateInfo, allocationCreateInfo, AllocationCategory::RenderTarget);
+        targets.sceneView = CreateImageView(targets.scene.Get(), sceneFormat);
+
+        imageCreateInfo.format = POST_RESULT_FORMAT;
+        imageCreateInfo.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc;
+        targets.result = allocator.CreateImage(imageCreateInfo, allocationCreateInfo, AllocationCategory::RenderTarget);
+        targets.resultView = CreateImageView(targets.result.Get(), POST_RESULT_FORMAT);
+        return targets;
+    }
+
+    [[nodiscard]] vk::raii::ImageView CreateImageView(vk::Image const image, vk::Format const format) const {
+        vk::ImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.image = image;
+        imageViewCreateInfo.viewType = vk::ImageViewType::e2D;
+        imageViewCreateInfo.format = format;
+        imageViewCreateInfo.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+        return vk::raii::ImageView{device, imageViewCreateInfo};
+    }
+
+    void UpdateDescriptorSet(Slot const &slot) const {
+        vk::DescriptorImageInfo const sceneInfo{
+            *sampler, *slot.targets.sceneView, vk::ImageLayout::eShaderReadOnlyOptimal
+        };
+        vk::DescriptorImageInfo const resultInfo{{}, *slot.targets.resultView, vk::ImageLayout::eGeneral};
+        std::array<vk::WriteDescriptorSet, 2> writes{};
+        writes[0].dstSet = *slot.descriptorSet;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+        writes[0].setImageInfo(sceneInfo);
+        writes[1].dstSet = *slot.descriptorSet;
+        writes[1].dstBinding = 1;
+        writes[1].descriptorType = vk::DescriptorType::eStorageImage;
+        writes[1].setImageInfo(resultInfo);
+        device.updateDescriptorSets(writes, {});
+    }
+};
@@ -0,0 +1,433 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "trace.hpp"
+
+constexpr uint32_t PROFILE_RING_CAPACITY{1 << 16};
+// Samples per zone the rolling averages are taken over
+constexpr uint32_t PROFILE_ROLLING_WINDOW{120};
+constexpr uint32_t MAX_GPU_ZONES_PER_FRAME{64};
+// Thread index of GPU zones in the ring and in exported traces
+constexpr uint32_t GPU_THREAD_INDEX{UINT32_MAX};
+// Same for GPU zones on the async compute queue, which overlap the graphics queue's
+constexpr uint32_t GPU_COMPUTE_THREAD_INDEX{UINT32_MAX - 1};
+
+// Counters collected for GPU zones when pipeline statistics queries are enabled, in the order Vulkan returns them
+struct PipelineStatistics {
+    uint64_t vertexShaderInvocations{};
+    uint64_t clippingPrimitives{};
+    uint64_t fragmentShaderInvocations{};
+    uint64_t computeShaderInvocations{};
+};
+
+constexpr vk::QueryPipelineStatisticFlags PIPELINE_STATISTICS_FLAGS{
+    vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+    vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+    vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations |
+    vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations
+};
+
+// One finished zone. Names have to be string literals or otherwise outlive the profiler.
+struct ProfileEvent {
+    std::string_view name{};
+    uint32_t threadIndex{};
+    uint32_t depth{};
+    uint64_t frame{};
+    // Nanoseconds since the profiler was created
+    int64_t start{};
+    int64_t end{};
+    std::optional<PipelineStatistics> statistics{};
+};
+
+// Fixed size ring any thread pushes into without locking, the oldest events are overwritten. A per-slot sequence
+// number tells the reader whether a slot holds the event it expects and whether it was rewritten while being copied.
+// Events are stored as relaxed atomic words, so a copy racing with a write is torn but never a data race.
+class ProfileRing {
+    static_assert(std::is_trivially_copyable_v<ProfileEvent>);
+    static constexpr size_t EVENT_WORD_COUNT{(sizeof(ProfileEvent) + sizeof(uint64_t) - 1) / sizeof(uint64_t)};
+    using EventWords = std::array<uint64_t, EVENT_WORD_COUNT>;
+
+    struct Slot {
+        std::atomic<uint64_t> sequence{};
+        std::array<std::atomic<uint64_t>, EVENT_WORD_COUNT> event{};
+    };
+
+    std::unique_ptr<Slot[]> slots{std::make_unique<Slot[]>(PROFILE_RING_CAPACITY)};
+    std::atomic<uint64_t> head{};
+
+public:
+    void Push(ProfileEvent const &event) {
+        auto const index{head.fetch_add(1, std::memory_order_relaxed)};
+        auto &slot{slots[index % PROFILE_RING_CAPACITY]};
+        // odd while being written, the reader drops what it copied in between
+        slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        EventWords words{};
+        std::memcpy(words.data(), &event, sizeof(event));
+        for (size_t i = 0; i < EVENT_WORD_COUNT; i++)
+            slot.event[i].store(words[i], std::memory_order_relaxed);
+        slot.sequence.store(index * 2 + 2, std::memory_order_release);
+    }
+
+    // Calls visit with every event pushed since first that is still in the ring and completely written, returns
+    // where the next read continues. Only one thread reads.
+    template<typename Visit>
+    uint64_t Read(uint64_t first, Visit &&visit) const {
+        auto const last{head.load(std::memory_order_acquire)};
+        first = std::max(first, last > PROFILE_RING_CAPACITY ? last - PROFILE_RING_CAPACITY : 0);
+        for (auto index{first}; index < last; index++) {
+            auto const &slot{slots[index % PROFILE_RING_CAPACITY]};
+            auto const sequence{slot.sequence.load(std::memory_order_acquire)};
+            if (sequence != index * 2 + 2)
+                continue;
+            EventWords words{};
+            for (size_t i = 0; i < EVENT_WORD_COUNT; i++)
+                words[i] = slot.event[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+                continue;
+            ProfileEvent event;
+            std::memcpy(&event, words.data(), sizeof(event));
+            visit(event);
+        }
+        return last;
+    }
+};
+
+// Rolling average of a zone over its last PROFILE_ROLLING_WINDOW occurrences
+struct ZoneSummary {
+    std::string_view name{};
+    bool gpu{};
+    double averageMilliseconds{};
+    double maxMilliseconds{};
+    std::optional<PipelineStatistics> lastStatistics{};
+};
+
+// Nested CPU zones from any thread and GPU zones read back from timestamp queries, kept in a lock-free ring. The ring
+// can be written as a Chrome trace_event file, which chrome://tracing and Perfetto open and Tracy's import-chrome
+// converts, and is folded into rolling per-zone averages.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct ZoneStatistics {
+        std::string_view name{};
+        bool gpu{};
+        std::array<double, PROFILE_ROLLING_WINDOW> samples{};
+        uint32_t sampleCount{};
+        uint32_t nextSample{};
+        std::optional<PipelineStatistics> lastStatistics{};
+    };
+
+    Clock::time_point const origin{Clock::now()};
+    ProfileRing ring{};
+    std::atomic<uint64_t> currentFrame{};
+
+    // Only touched when a thread first shows up or is named
+    mutable std::mutex threadMutex{};
+    std::vector<std::string> threadNames{};
+
+    // Only touched by the thread calling Collect() and GetSummary()
+    uint64_t collectedHead{};
+    std::vector<ZoneStatistics> zoneStatistics{};
+
+public:
+    Profiler() = default;
+    Profiler(Profiler const &) = delete;
+    Profiler &operator=(Profiler const &) = delete;
+
+    [[nodiscard]] int64_t Now() const { return ToNanoseconds(Clock::now()); }
+
+    [[nodiscard]] int64_t ToNanoseconds(Clock::time_point const timePoint) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint - origin).count();
+    }
+
+    // Frame number CPU zones are tagged with from now on
+    void SetFrame(uint64_t const frame) { currentFrame.store(frame, std::memory_order_relaxed); }
+
+    // Names the calling thread in exported traces, threads that never call this show up as "thread N"
+    void SetThreadName(std::string name) {
+        auto const index{ThreadIndex()};
+        std::scoped_lock lock{threadMutex};
+        threadNames[index] = std::move(name);
+    }
+
+    void AddCpuZone(std::string_view const name, uint32_t const depth, int64_t const start, int64_t const end) {
+        ring.Push(ProfileEvent{name, ThreadIndex(), depth, currentFrame.load(std::memory_order_relaxed), start, end});
+    }
+
+    void AddGpuZone(std::string_view const name, uint32_t const depth, uint64_t const frame, int64_t const start,
+                    int64_t const end, std::optional<PipelineStatistics> const &statistics,
+                    uint32_t const threadIndex = GPU_THREAD_INDEX) {
+        ring.Push(ProfileEvent{name, threadIndex, depth, frame, start, end, statistics});
+    }
+
+    // Folds the events pushed since the last call into the rolling averages
+    void Collect() {
+        collectedHead = ring.Read(collectedHead, [this](ProfileEvent const &event) {
+            auto const gpu{event.threadIndex >= GPU_COMPUTE_THREAD_INDEX};
+            auto zone{
+                std::ranges::find_if(zoneStatistics, [&](ZoneStatistics const &statistics) {
+                    return statistics.gpu == gpu && statistics.name == event.name;
+                })
+            };
+            if (zone == zoneStatistics.end()) {
+                zoneStatistics.push_back(ZoneStatistics{event.name, gpu});
+                zone = zoneStatistics.end() - 1;
+            }
+            zone->samples[zone->nextSample] = static_cast<double>(event.end - event.start) * 1e-6;
+            zone->nextSample = (zone->nextSample + 1) % PROFILE_ROLLING_WINDOW;
+            zone->sampleCount = std::min(zone->sampleCount + 1, PROFILE_ROLLING_WINDOW);
+            if (event.statistics)
+                zone->lastStatistics = event.statistics;
+        });
+    }
+
+    // Zones in the order they were first seen, as of the last Collect()
+    [[nodiscard]] std::vector<ZoneSummary> GetSummary() const {
+        std::vector<ZoneSummary> summary{};
+        for (auto const &zone: zoneStatistics) {
+            std::span const samples{zone.samples.data(), zone.sampleCount};
+            double total{};
+            for (auto const sample: samples)
+                total += sample;
+            summary.push_back(ZoneSummary{
+                zone.name, zone.gpu, samples.empty() ? 0.0 : total / static_cast<double>(samples.size()),
+                samples.empty() ? 0.0 : std::ranges::max(samples), zone.lastStatistics
+            });
+        }
+        return summary;
+    }
+
+    void PrintSummary() const {
+        for (auto const &[name, gpu, averageMilliseconds, maxMilliseconds, statistics]: GetSummary()) {
+            std::print("{} {:<24} avg {:8.3f} ms  max {:8.3f} ms", gpu ? "GPU" : "CPU", name, averageMilliseconds,
+                       maxMilliseconds);
+            if (statistics)
+                std::print("  vs {} clip {} fs {} cs {}", statistics->vertexShaderInvocations,
+                           statistics->clippingPrimitives, statistics->fragmentShaderInvocations,
+                           statistics->computeShaderInvocations);
+            std::println();
+        }
+    }
+
+    // Writes the events still in the ring, returns false when the file could not be written
+    bool WriteChromeTrace(std::filesystem::path const &filename) const {
+        std::ofstream output{filename};
+        if (!output)
+            return false;
+
+        std::vector<std::string> entries{};
+        {
+            std::scoped_lock lock{threadMutex};
+            for (uint32_t i = 0; i < threadNames.size(); i++)
+                entries.push_back(ThreadNameEntry(i, threadNames[i].empty()
+                                                         ? std::format("thread {}", i)
+                                                         : threadNames[i]));
+        }
+        entries.push_back(ThreadNameEntry(GPU_THREAD_INDEX, "GPU"));
+        entries.push_back(ThreadNameEntry(GPU_COMPUTE_THREAD_INDEX, "GPU compute"));
+        ring.Read(0, [&](ProfileEvent const &event) {
+            auto args{std::format(R"("frame": {})", event.frame)};
+            if (event.statistics)
+                args += std::format(
+                    R"(, "vertex_shader_invocations": {}, "clipping_primitives": {}, )"
+                    R"("fragment_shader_invocations": {}, "compute_shader_invocations": {})",
+                    event.statistics->vertexShaderInvocations, event.statistics->clippingPrimitives,
+                    event.statistics->fragmentShaderInvocations, event.statistics->computeShaderInvocations);
+            entries.push_back(std::format(
+                R"({{"name": "{}", "ph": "X", "pid": 0, "tid": {}, "ts": {:.3f}, "dur": {:.3f}, "args": {{{}}}}})",
+                TraceRecorder::Escape(event.name), event.threadIndex, static_cast<double>(event.start) * 1e-3,
+                static_cast<double>(event.end - event.start) * 1e-3, args));
+        });
+
+        std::println(output, R"({{"displayTimeUnit": "ms", "traceEvents": [)");
+        for (size_t i = 0; i < entries.size(); i++)
+            std::println(output, "  {}{}", entries[i], i + 1 == entries.size() ? "" : ",");
+        std::println(output, "]}}");
+        return static_cast<bool>(output);
+    }
+
+private:
+    // Indices are handed out once per thread and shared by every profiler
+    uint32_t ThreadIndex() {
+        static std::atomic<uint32_t> threadCount{};
+        thread_local uint32_t const index{threadCount.fetch_add(1, std::memory_order_relaxed)};
+        thread_local Profiler const *registeredWith{};
+        if (registeredWith != this) {
+            registeredWith = this;
+            std::scoped_lock lock{threadMutex};
+            if (threadNames.size() <= index)
+                threadNames.resize(index + 1);
+        }
+        return index;
+    }
+
+    static std::string ThreadNameEntry(uint32_t const threadIndex, std::string_view const name) {
+        return std::format(R"({{"name": "thread_name", "ph": "M", "pid": 0, "tid": {}, "args": {{"name": "{}"}}}})",
+                           threadIndex, TraceRecorder::Escape(name));
+    }
+};
+
+// CPU zone between construction and destruction, nested zones on the same thread get a greater depth. Does nothing
+// without a profiler.
+class ProfileZone {
+    static inline thread_local uint32_t depth{};
+
+    Profiler *profiler;
+    std::string_view name;
+    int64_t start{};
+
+public:
+    ProfileZone(Profiler *profiler, std::string_view const name) : profiler{profiler}, name{name} {
+        if (profiler) {
+            depth++;
+            start = profiler->Now();
+        }
+    }
+
+    ~ProfileZone() {
+        if (profiler)
+            profiler->AddCpuZone(name, --depth, start, profiler->Now());
+    }
+
+    ProfileZone(ProfileZone const &) = delete;
+    ProfileZone &operator=(ProfileZone const &) = delete;
+};
+
+// Timestamp and optional pipeline statistics queries of one frame slot. Zones may be opened from any recording thread,
+// the pools are reset at the start of the slot's primary command buffer and read once the slot's timeline value has
+// been reached, so reading never waits. GPU times are placed on the CPU timeline relative to the frame's submission.
+class GpuZoneQueries {
+    static constexpr uint32_t INVALID_ZONE{UINT32_MAX};
+
+    struct Zone {
+        std::string_view name{};
+        uint32_t depth{};
+        bool statistics{};
+    };
+
+    vk::raii::QueryPool timestampPool{nullptr};
+    vk::raii::QueryPool statisticsPool{nullptr};
+    double timestampPeriod;
+    uint32_t threadIndex;
+    std::array<Zone, MAX_GPU_ZONES_PER_FRAME> zones{};
+    std::atomic<uint32_t> zoneCount{};
+    uint64_t frame{};
+    int64_t submitTime{};
+    bool pending{};
+
+public:
+    // threadIndex is the track the zones show up on, GPU_COMPUTE_THREAD_INDEX for the async compute queue
+    GpuZoneQueries(vk::raii::Device const &device, double const timestampPeriod, bool const pipelineStatistics,
+                   uint32_t const threadIndex = GPU_THREAD_INDEX)
+        : timestampPeriod{timestampPeriod}, threadIndex{threadIndex} {
+        vk::QueryPoolCreateInfo queryPoolCreateInfo{};
+        queryPoolCreateInfo.queryType = vk::QueryType::eTimestamp;
+        queryPoolCreateInfo.queryCount = MAX_GPU_ZONES_PER_FRAME * 2;
+        timestampPool = vk::raii::QueryPool{device, queryPoolCreateInfo};
+        if (pipelineStatistics) {
+            queryPoolCreateInfo.queryType = vk::QueryType::ePipelineStatistics;
+            queryPoolCreateInfo.queryCount = MAX_GPU_ZONES_PER_FRAME;
+            queryPoolCreateInfo.pipelineStatistics = PIPELINE_STATISTICS_FLAGS;
+            statisticsPool = vk::raii::QueryPool{device, queryPoolCreateInfo};
+        }
+    }
+
+    GpuZoneQueries(GpuZoneQueries const &) = delete;
+    GpuZoneQueries &operator=(GpuZoneQueries const &) = delete;
+
+    // Recorded first into the frame's primary command buffer, before any zone is opened
+    void Reset(vk::raii::CommandBuffer const &commandBuffer, uint64_t const frame) {
+        this->frame = frame;
+        zoneCount.store(0, std::memory_order_relaxed);
+        commandBuffer.resetQueryPool(*timestampPool, 0, MAX_GPU_ZONES_PER_FRAME * 2);
+        if (*statisticsPool)
+            commandBuffer.resetQueryPool(*statisticsPool, 0, MAX_GPU_ZONES_PER_FRAME);
+    }
+
+    // Returns the zone to pass to EndZone. Pipeline statistics queries can't span command buffers or be nested, so
+    // only zones opened and closed in the same command buffer outside other statistics zones may ask for them.
+    uint32_t BeginZone(vk::raii::CommandBuffer const &commandBuffer, std::string_view const name,
+                       uint32_t const depth, bool const statistics = false) {
+        auto const zone{zoneCount.fetch_add(1, std::memory_order_relaxed)};
+        if (zone >= MAX_GPU_ZONES_PER_FRAME)
+            return INVALID_ZONE;
+        zones[zone] = Zone{name, depth, statistics && *statisticsPool};
+        commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe, *timestampPool, zone * 2);
+        if (zones[zone].statistics)
+            commandBuffer.beginQuery(*statisticsPool, zone, {});
+        return zone;
+    }
+
+    void EndZone(vk::raii::CommandBuffer const &commandBuffer, uint32_t const zone) const {
+        if (zone == INVALID_ZONE)
+            return;
+        if (zones[zone].statistics)
+            commandBuffer.endQuery(*statisticsPool, zone);
+        commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eBottomOfPipe, *timestampPool, zone * 2 + 1);
+    }
+
+    // The CPU time GPU zones are placed at, call when submitting
+    void MarkSubmitted(int64_t const submitTime) {
+        this->submitTime = submitTime;
+        pending = true;
+    }
+
+    // Hands the zones of the slot's last frame to the profiler and returns the duration of its first zone in
+    // milliseconds. Only valid once the frame's timeline value has been reached.
+    std::optional<double> Read(Profiler &profiler) {
+        if (!std::exchange(pending, false))
+            return std::nullopt;
+        auto const count{std::min(zoneCount.load(std::memory_order_relaxed), MAX_GPU_ZONES_PER_FRAME)};
+        if (count == 0)
+            return std::nullopt;
+        auto const [result, timestamps] = timestampPool.getResults<uint64_t>(
+            0, count * 2, count * 2 * sizeof(uint64_t), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+        if (result != vk::Result::eSuccess)
+            return std::nullopt;
+        std::vector<PipelineStatistics> statistics{};
+        if (*statisticsPool) {
+            auto [statisticsResult, values] = statisticsPool.getResults<PipelineStatistics>(
+                0, count, count * sizeof(PipelineStatistics), sizeof(PipelineStatistics),
+                vk::QueryResultFlagBits::e64);
+            // zones without statistics queries leave their results unavailable, which only drops them
+            if (statisticsResult == vk::Result::eSuccess || statisticsResult == vk::Result::eNotReady)
+                statistics = std::move(values);
+        }
+
+        auto const origin{timestamps[0]};
+        auto const toNanoseconds{
+            [&](uint64_t const timestamp) {
+                return submitTime + static_cast<int64_t>(static_cast<double>(timestamp - origin) * timestampPeriod);
+            }
+        };
+        for (uint32_t zone = 0; zone < count; zone++)
+            profiler.AddGpuZone(zones[zone].name, zones[zone].depth, frame, toNanoseconds(timestamps[zone * 2]),
+                                toNanoseconds(timestamps[zone * 2 + 1]),
+                                zones[zone].statistics && zone < statistics.size()
+                                    ? std::optional{statistics[zone]}
+                                    : std::nullopt, threadIndex);
+        return static_cast<double>(timestamps[1] - timestamps[0]) * timestampPeriod * 1e-6;
+    }
+};
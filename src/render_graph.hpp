@@ -0,0 +1,280 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "image_layout.hpp"
+
+enum class ResourceUsage {
+    TransferSrc,
+    TransferDst,
+    ColorAttachment,
+    SampledFragment,
+    SampledCompute,
+    StorageReadCompute,
+    StorageWriteCompute,
+    Present,
+};
+
+// How a pass touches an image: the layout it needs and the stage and access it happens in
+struct UsageInfo {
+    ImageLayout layout{};
+    bool write{};
+};
+
+constexpr UsageInfo GetUsageInfo(ResourceUsage const usage) {
+    switch (usage) {
+        case ResourceUsage::TransferSrc:
+            return {{vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits2::eTransfer,
+                     vk::AccessFlagBits2::eTransferRead}, false};
+        case ResourceUsage::TransferDst:
+            return {{vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits2::eTransfer,
+                     vk::AccessFlagBits2::eTransferWrite}, true};
+        case ResourceUsage::ColorAttachment:
+            return {{vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                     vk::AccessFlagBits2::eColorAttachmentWrite}, true};
+        case ResourceUsage::SampledFragment:
+            return {{vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits2::eFragmentShader,
+                     vk::AccessFlagBits2::eShaderSampledRead}, false};
+        case ResourceUsage::SampledCompute:
+            return {{vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits2::eComputeShader,
+                     vk::AccessFlagBits2::eShaderSampledRead}, false};
+        case ResourceUsage::StorageReadCompute:
+            return {{vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits2::eComputeShader,
+                     vk::AccessFlagBits2::eShaderStorageRead}, false};
+        case ResourceUsage::StorageWriteCompute:
+            return {{vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits2::eComputeShader,
+                     vk::AccessFlagBits2::eShaderStorageWrite}, true};
+        case ResourceUsage::Present:
+            // the semaphore signal after the barrier orders presentation, no later stage has to wait
+            return {{vk::ImageLayout::ePresentSrcKHR, vk::PipelineStageFlagBits2::eNone,
+                     vk::AccessFlagBits2::eNone}, false};
+    }
+    return {};
+}
+
+// Per-frame graph of passes over imported images. Passes declare which images they use and how, the graph tracks the
+// layout and pending writes of every image and emits only the barriers that are needed, batched into a single
+// pipelineBarrier2 per pass boundary. States are tracked per image, over the subresource range given on import.
+// Pass data is copied into the arena given to Reset(), which has to outlive the frame's recording.
+class RenderGraph {
+public:
+    using ImageHandle = uint32_t;
+
+    // Non-owning callable recording a pass, the callable itself lives in the graph's arena
+    class Record {
+        void const *callable{};
+        void (*invoke)(void const *callable, vk::raii::CommandBuffer const &commandBuffer){};
+
+    public:
+        Record() = default;
+
+        template<typename Function>
+        explicit Record(Function const &function)
+            : callable{&function}, invoke{
+                  [](void const *callable, vk::raii::CommandBuffer const &commandBuffer) {
+                      (*static_cast<Function const *>(callable))(commandBuffer);
+                  }
+              } {}
+
+        void operator()(vk::raii::CommandBuffer const &commandBuffer) const { invoke(callable, commandBuffer); }
+    };
+
+    struct ImageAccess {
+        ImageHandle image{};
+        ResourceUsage usage{};
+    };
+
+    struct Pass {
+        std::string_view name{};
+        std::span<ImageAccess const> accesses{};
+        Record record{};
+    };
+
+private:
+    struct ImageState {
+        vk::Image image{};
+        vk::ImageSubresourceRange range{};
+        vk::ImageLayout layout{};
+        // last write, not yet made visible to every later reader
+        vk::PipelineStageFlags2 writeStages{};
+        vk::AccessFlags2 writeAccess{};
+        // stages reading since the last write, a later write or layout change has to wait for them
+        vk::PipelineStageFlags2 readStages{};
+        // stage/access pairs the last write has already been made visible to
+        vk::PipelineStageFlags2 visibleStages{};
+        vk::AccessFlags2 visibleAccess{};
+        std::optional<ResourceUsage> finalUsage{};
+        // queue families of the ownership transfer the final barrier releases the image with
+        uint32_t srcQueueFamilyIndex{VK_QUEUE_FAMILY_IGNORED};
+        uint32_t dstQueueFamilyIndex{VK_QUEUE_FAMILY_IGNORED};
+    };
+
+    std::vector<ImageState> images{};
+    std::vector<Pass> passes{};
+    std::vector<vk::ImageMemoryBarrier2> externalBarriers{};
+    // barriers of pass i are barriers[barrierOffsets[i], barrierOffsets[i + 1]), the last range is the final one
+    std::vector<vk::ImageMemoryBarrier2> barriers{};
+    std::vector<size_t> barrierOffsets{};
+    std::pmr::memory_resource *arena{std::pmr::get_default_resource()};
+
+public:
+    // Starts a new frame, everything the previous one allocated in its arena may be gone
+    void Reset(std::pmr::memory_resource &arena) {
+        this->arena = &arena;
+        images.clear();
+        passes.clear();
+        externalBarriers.clear();
+        barriers.clear();
+        barrierOffsets.clear();
+    }
+
+    // state is the layout the image is in and the stage/access of the last write to it that may still be pending
+    ImageHandle ImportImage(vk::Image const image, ImageLayout const &state,
+                            vk::ImageSubresourceRange const &range = {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}) {
+        images.push_back(ImageState{image, range, state.imageLayout, state.stageMask, state.accessMask});
+        return static_cast<ImageHandle>(images.size() - 1);
+    }
+
+    // Layout the image is left in after the last pass, for example Present for swapchain images. With two different
+    // queue families the final barrier is the release half of an ownership transfer, the queue of dstQueueFamilyIndex
+    // has to acquire the image with the same layouts before using it.
+    void SetFinalUsage(ImageHandle const image, ResourceUsage const usage,
+                       uint32_t const srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                       uint32_t const dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED) {
+        images[image].finalUsage = usage;
+        images[image].srcQueueFamilyIndex = srcQueueFamilyIndex;
+        images[image].dstQueueFamilyIndex = dstQueueFamilyIndex;
+    }
+
+    // Barrier recorded in the first batch, for work the graph does not track such as queue family ownership transfers
+    void AddExternalBarrier(vk::ImageMemoryBarrier2 const &barrier) {
+        externalBarriers.push_back(barrier);
+    }
+
+    // name has to outlive the frame, string literals do. The function is called once from a recording thread and
+    // is never destroyed, so it can only capture what is trivially destructible.
+    template<typename Function>
+    void AddPass(std::string_view const name, std::span<ImageAccess const> const accesses, Function &&function) {
+        using Callable = std::remove_cvref_t<Function>;
+        static_assert(std::is_trivially_destructible_v<Callable>, "pass functions are never destroyed");
+        auto const passAccesses{static_cast<ImageAccess *>(arena->allocate(accesses.size_bytes(),
+                                                                           alignof(ImageAccess)))};
+        std::ranges::uninitialized_copy(accesses, std::span{passAccesses, accesses.size()});
+        auto const callable{std::construct_at(static_cast<Callable *>(arena->allocate(sizeof(Callable),
+                                                                                        alignof(Callable))),
+                                              std::forward<Function>(function))};
+        passes.push_back(Pass{name, {passAccesses, accesses.size()}, Record{*callable}});
+    }
+
+    [[nodiscard]] std::span<Pass const> GetPasses() const { return passes; }
+
+    // Scratch memory released with the frame, for data passes capture by pointer or span
+    [[nodiscard]] std::pmr::memory_resource &GetArena() const { return *arena; }
+
+    // Computes the barrier batches, passes must not be added afterwards
+    void Compile() {
+        barriers.assign(externalBarriers.begin(), externalBarriers.end());
+        barrierOffsets.assign(1, 0);
+        for (auto const &pass: passes) {
+            for (auto const &[image, usage]: pass.accesses)
+                Access(images[image], usage);
+            barrierOffsets.push_back(barriers.size());
+        }
+        for (auto &state: images) {
+            if (!state.finalUsage)
+                continue;
+            if (state.srcQueueFamilyIndex == state.dstQueueFamilyIndex) {
+                Access(state, *state.finalUsage);
+                continue;
+            }
+            // a release waits for every access so far, visibility on the other queue is up to its acquire
+            auto const target{GetUsageInfo(*state.finalUsage).layout};
+            AddBarrier(state, state.writeStages | state.readStages, state.writeAccess, ImageLayout{target.imageLayout});
+            barriers.back().srcQueueFamilyIndex = state.srcQueueFamilyIndex;
+            barriers.back().dstQueueFamilyIndex = state.dstQueueFamilyIndex;
+        }
+        barrierOffsets.push_back(barriers.size());
+    }
+
+    // Records the compiled barriers around the passes, passCommandBuffers[i] holds the secondary recorded for pass i
+    void Execute(vk::raii::CommandBuffer const &commandBuffer,
+                 std::span<vk::CommandBuffer const> const passCommandBuffers) const {
+        for (size_t i = 0; i < passes.size(); i++) {
+            RecordBarriers(commandBuffer, i);
+            commandBuffer.executeCommands(passCommandBuffers[i]);
+        }
+        RecordBarriers(commandBuffer, passes.size());
+    }
+
+private:
+    void RecordBarriers(vk::raii::CommandBuffer const &commandBuffer, size_t const batch) const {
+        auto const first{barrierOffsets[batch]};
+        auto const count{barrierOffsets[batch + 1] - first};
+        if (count == 0)
+            return;
+        vk::DependencyInfo dependencyInfo{};
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(count);
+        dependencyInfo.pImageMemoryBarriers = barriers.data() + first;
+        commandBuffer.pipelineBarrier2(dependencyInfo);
+    }
+
+    void AddBarrier(ImageState const &state, vk::PipelineStageFlags2 const srcStages,
+                    vk::AccessFlags2 const srcAccess, ImageLayout const &target) {
+        vk::ImageMemoryBarrier2 barrier{};
+        barrier.srcStageMask = srcStages;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask = target.stageMask;
+        barrier.dstAccessMask = target.accessMask;
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = target.imageLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = state.image;
+        barrier.subresourceRange = state.range;
+        barriers.push_back(barrier);
+    }
+
+    void Access(ImageState &state, ResourceUsage const usage) {
+        auto const [target, write]{GetUsageInfo(usage)};
+
+        if (state.layout != target.imageLayout || write) {
+            // layout transitions and writes have to wait for every earlier access, reads only need an execution
+            // dependency, writes also need their memory made available
+            auto const srcStages{state.writeStages | state.readStages};
+            // nothing happened to the image yet and it's not being transitioned, so nothing to wait for
+            if (srcStages || state.layout != target.imageLayout)
+                AddBarrier(state, srcStages, state.writeAccess, target);
+            state.layout = target.imageLayout;
+            state.readStages = {};
+            if (write) {
+                state.writeStages = target.stageMask;
+                state.writeAccess = target.accessMask;
+                state.visibleStages = {};
+                state.visibleAccess = {};
+            } else {
+                // the transition is available, later readers in other stages only need to be ordered after it
+                state.writeStages = target.stageMask;
+                state.writeAccess = {};
+                state.visibleStages = target.stageMask;
+                state.visibleAccess = target.accessMask;
+                state.readStages = target.stageMask;
+            }
+            return;
+        }
+
+        // read in the current layout, only wait if the last write isn't visible to this stage/access yet
+        if (state.writeStages && ((target.stageMask & ~state.visibleStages) ||
+                                  (target.accessMask & ~state.visibleAccess))) {
+            AddBarrier(state, state.writeStages, state.writeAccess, target);
+            state.visibleStages |= target.stageMask;
+            state.visibleAccess |= target.accessMask;
+        }
+        state.readStages |= target.stageMask;
+    }
+};
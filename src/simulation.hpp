@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vulkan/vulkan_raii.hpp>
+
+// Lock-free queue between exactly one producer and one consumer thread, Capacity has to be a power of two
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity has to be a power of two");
+
+    std::array<T, Capacity> items{};
+    // written by the producer only, read by the consumer
+    alignas(64) std::atomic<size_t> tail{};
+    // written by the consumer only, read by the producer
+    alignas(64) std::atomic<size_t> head{};
+
+public:
+    // Returns false without pushing when the queue is full
+    bool TryPush(T const &item) {
+        auto const currentTail{tail.load(std::memory_order_relaxed)};
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        items[currentTail % Capacity] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> TryPop() {
+        auto const currentHead{head.load(std::memory_order_relaxed)};
+        if (currentHead == tail.load(std::memory_order_acquire))
+            return std::nullopt;
+        auto item{items[currentHead % Capacity]};
+        head.store(currentHead + 1, std::memory_order_release);
+        return item;
+    }
+};
+
+// Triple buffer handing the latest value from one writer to one reader without either ever waiting for the other. The
+// writer fills its back buffer and publishes it, the reader always gets the most recent publish and keeps it unchanged
+// until it acquires again.
+template<typename T>
+class SnapshotBuffer {
+    // set on the shared index while it holds a publish the reader has not taken yet
+    static constexpr uint32_t FRESH{4};
+
+    std::array<T, 3> buffers{};
+    uint32_t back{0};
+    std::atomic<uint32_t> shared{1};
+    uint32_t front{2};
+    std::atomic<uint64_t> publishCount{};
+
+public:
+    // Only for the writer
+    T &GetBack() { return buffers[back]; }
+
+    void Publish() {
+        back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+        publishCount.fetch_add(1, std::memory_order_release);
+        publishCount.notify_all();
+    }
+
+    // Only for the reader, the returned value stays valid until the next call
+    T const &Acquire() {
+        if (shared.load(std::memory_order_relaxed) & FRESH)
+            front = shared.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return buffers[front];
+    }
+
+    [[nodiscard]] uint64_t GetPublishCount() const { return publishCount.load(std::memory_order_acquire); }
+
+    // Blocks until something is published after publishCount reached count
+    void WaitForPublish(uint64_t const count) const { publishCount.wait(count, std::memory_order_acquire); }
+};
+
+// What the event thread forwards to the update thread, already translated out of SDL's event union
+struct InputEvent {
+    enum class Type {
+        Resize,
+        Minimize,
+        Restore,
+        PointerMove,
+        PointerLeave,
+        MemoryReport,
+        ProfileDump,
+    };
+
+    Type type{};
+    // Pixels, the new extent for Resize and the position for PointerMove
+    float x{};
+    float y{};
+};
+
+// Immutable state of the simulation at one tick, everything the render thread needs to draw a frame
+struct FrameSnapshot {
+    uint64_t tick{};
+    // Simulated seconds, advancing by exactly one tick period per tick
+    double time{};
+    vk::Extent2D windowExtent{};
+    bool minimized{};
+    // Grows with every resize, the render thread recreates the swapchain when it changed
+    uint32_t resizeCount{};
+    // Point the sprites gather around in pixels, absent while the pointer is outside the window
+    std::optional<std::array<float, 2>> focus{};
+    // Grow with every request, the render thread handles them once each
+    uint32_t memoryReportRequests{};
+    uint32_t profileDumpRequests{};
+};
+
+// Fixed tick simulation, stepped and fed with input by the update thread only
+class Simulation {
+    // How quickly the focus closes in on the pointer, per second
+    static constexpr double FOCUS_FOLLOW_RATE{8.0};
+
+    FrameSnapshot state{};
+    std::optional<std::array<float, 2>> pointer{};
+
+public:
+    explicit Simulation(vk::Extent2D const windowExtent) { state.windowExtent = windowExtent; }
+
+    void Apply(InputEvent const &event) {
+        switch (event.type) {
+            case InputEvent::Type::Resize:
+                state.windowExtent = vk::Extent2D{static_cast<uint32_t>(event.x), static_cast<uint32_t>(event.y)};
+                state.resizeCount++;
+                break;
+            case InputEvent::Type::Minimize:
+                state.minimized = true;
+                break;
+            case InputEvent::Type::Restore:
+                state.minimized = false;
+                break;
+            case InputEvent::Type::PointerMove:
+                pointer = std::array{event.x, event.y};
+                break;
+            case InputEvent::Type::PointerLeave:
+                pointer.reset();
+                break;
+            case InputEvent::Type::MemoryReport:
+                state.memoryReportRequests++;
+                break;
+            case InputEvent::Type::ProfileDump:
+                state.profileDumpRequests++;
+                break;
+        }
+    }
+
+    void Step(double const tickSeconds) {
+        state.tick++;
+        state.time += tickSeconds;
+        if (!pointer) {
+            state.focus.reset();
+            return;
+        }
+        if (!state.focus) {
+            state.focus = pointer;
+            return;
+        }
+        // frame rate independent easing, the same per tick whatever the render thread does
+        auto const blend{static_cast<float>(1.0 - std::exp(-FOCUS_FOLLOW_RATE * tickSeconds))};
+        for (size_t i = 0; i < 2; i++)
+            (*state.focus)[i] += ((*pointer)[i] - (*state.focus)[i]) * blend;
+    }
+
+    [[nodiscard]] FrameSnapshot const &GetState() const { return state; }
+};
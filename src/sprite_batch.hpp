@@ -0,0 +1,330 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "frame_allocator.hpp"
+#include "memory.hpp"
+#include "pipeline.hpp"
+#include "render_graph.hpp"
+#include "texture_registry.hpp"
+
+// One textured quad, read by the shaders as a std430 array. Submitted sprites are written straight into mapped memory,
+// so filling one in place is all the CPU work a sprite costs.
+struct Sprite {
+    // Center and size in pixels, y pointing down; a negative size mirrors the sprite
+    float position[2]{};
+    float scale[2]{};
+    // Sub-rectangle of the texture in normalized coordinates
+    float uvOffset[2]{};
+    float uvScale[2]{1.0f, 1.0f};
+    TextureHandle texture{};
+    // RGBA8 multiplied with the texel, red in the lowest byte
+    uint32_t tint{0xFFFFFFFF};
+};
+static_assert(sizeof(Sprite) == 40);
+
+constexpr uint32_t DEFAULT_SPRITE_CAPACITY{1 << 18};
+
+struct SpritePushConstants {
+    float viewportSize[2]{};
+    // Index of the frame's first sprite in the transient buffer
+    uint32_t spriteBase{};
+    uint32_t spriteCount{};
+    uint32_t regionBase{};
+    uint32_t textureCount{};
+};
+
+// GPU driven 2D batch renderer. Sprites are written into room reserved in the frame's transient buffer, a compute pass
+// culls them against the viewport and texture residency and compacts the survivors into a visible list while counting
+// them into an indirect draw command, and a single indirect draw renders them all.
+class SpriteBatch {
+    static constexpr uint32_t CULL_GROUP_SIZE{64};
+
+    struct SlotBuffers {
+        AllocatedBuffer visibleSprites{};
+        AllocatedBuffer drawCommand{};
+        vk::raii::DescriptorSet descriptorSet{nullptr};
+    };
+
+    vk::raii::Device const &device;
+    uint32_t capacity;
+
+    vk::raii::DescriptorSetLayout descriptorSetLayout{nullptr};
+    vk::raii::DescriptorPool descriptorPool{nullptr};
+    vk::raii::PipelineLayout pipelineLayout{nullptr};
+    vk::raii::Pipeline cullPipeline{nullptr};
+    vk::raii::Pipeline drawPipeline{nullptr};
+    std::vector<SlotBuffers> slots{};
+
+    uint32_t currentSlot{};
+    Sprite *sprites{};
+    uint32_t spriteBase{};
+    uint32_t reservedCount{};
+    uint32_t spriteCount{};
+
+public:
+    // Sprites are read from transientBuffer, which has to outlive the batch
+    SpriteBatch(vk::raii::Device const &device, Allocator &allocator, PersistentPipelineCache const &pipelineCache,
+                TextureRegistry const &textureRegistry, TransientBuffer const &transientBuffer,
+                vk::Format const colorFormat, uint32_t const frameSlotCount,
+                uint32_t const capacity = DEFAULT_SPRITE_CAPACITY)
+        : device{device}, capacity{capacity} {
+        std::array const bindings{
+            vk::DescriptorSetLayoutBinding{
+                0, vk::DescriptorType::eStorageBuffer, 1,
+                vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex
+            },
+            vk::DescriptorSetLayoutBinding{
+                1, vk::DescriptorType::eStorageBuffer, 1,
+                vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex
+            },
+            vk::DescriptorSetLayoutBinding{2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        };
+        vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+        descriptorSetLayoutCreateInfo.setBindings(bindings);
+        descriptorSetLayout = vk::raii::DescriptorSetLayout{device, descriptorSetLayoutCreateInfo};
+
+        // vk::raii::DescriptorSet frees itself, which needs eFreeDescriptorSet
+        vk::DescriptorPoolSize const poolSize{
+            vk::DescriptorType::eStorageBuffer, static_cast<uint32_t>(bindings.size()) * frameSlotCount
+        };
+        vk::DescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+        descriptorPoolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+        descriptorPoolCreateInfo.maxSets = frameSlotCount;
+        descriptorPoolCreateInfo.setPoolSizes(poolSize);
+        descriptorPool = vk::raii::DescriptorPool{device, descriptorPoolCreateInfo};
+
+        std::array const setLayouts{*textureRegistry.GetDescriptorSetLayout(), *descriptorSetLayout};
+        vk::PushConstantRange const pushConstantRange{
+            vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex, 0, sizeof(SpritePushConstants)
+        };
+        vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.setSetLayouts(setLayouts);
+        pipelineLayoutCreateInfo.setPushConstantRanges(pushConstantRange);
+        pipelineLayout = vk::raii::PipelineLayout{device, pipelineLayoutCreateInfo};
+
+        InitCullPipeline(pipelineCache);
+        InitDrawPipeline(pipelineCache, colorFormat);
+
+        for (uint32_t i = 0; i < frameSlotCount; i++)
+            slots.push_back(CreateSlotBuffers(allocator, transientBuffer));
+    }
+
+    SpriteBatch(SpriteBatch const &) = delete;
+    SpriteBatch &operator=(SpriteBatch const &) = delete;
+
+    // Starts collecting the sprites of a frame slot, its previous submission has to have completed. Reserves room for
+    // up to maxSprites in the transient buffer, which has to be reset for the slot and is flushed by the caller.
+    void Begin(uint32_t const frameSlot, TransientBuffer &transientBuffer, uint32_t const maxSprites) {
+        currentSlot = frameSlot;
+        spriteCount = 0;
+        reservedCount = 0;
+        auto const count{std::min(maxSprites, capacity)};
+        if (count == 0)
+            return;
+        // sprite sized alignment, so the shaders can index from the start of the buffer
+        if (auto const allocation{transientBuffer.Allocate(count * sizeof(Sprite), sizeof(Sprite))}) {
+            sprites = reinterpret_cast<Sprite *>(allocation->data);
+            spriteBase = static_cast<uint32_t>(allocation->offset / sizeof(Sprite));
+            reservedCount = count;
+        }
+    }
+
+    void Submit(Sprite const &sprite) {
+        if (spriteCount < reservedCount)
+            sprites[spriteCount++] = sprite;
+    }
+
+    // Room for count more sprites to be filled in place, shorter once the reservation is used up
+    std::span<Sprite> Allocate(uint32_t const count) {
+        auto const allocated{std::min(count, reservedCount - spriteCount)};
+        std::span const allocatedSprites{sprites + spriteCount, allocated};
+        spriteCount += allocated;
+        return allocatedSprites;
+    }
+
+    [[nodiscard]] uint32_t GetSpriteCount() const { return spriteCount; }
+
+    // Adds the culling pass, which has to come before the pass calling RecordDraw. Buffers are not tracked by the
+    // render graph, so the pass orders its own writes against the indirect draw.
+    void AddCullPass(RenderGraph &renderGraph, TextureRegistry const &textureRegistry, vk::Extent2D const viewport,
+                     uint32_t const regionBase) const {
+        if (spriteCount == 0)
+            return;
+        renderGraph.AddPass("sprite cull", {},
+                            [this, &textureRegistry, pushConstants{
+                                MakePushConstants(textureRegistry, viewport, regionBase)
+                            }](vk::raii::CommandBuffer const &commandBuffer) {
+                                RecordCull(commandBuffer, textureRegistry, pushConstants);
+                            });
+    }
+
+    // Draws the visible sprites inside the caller's dynamic rendering scope, viewport and scissor have to be set
+    void RecordDraw(vk::raii::CommandBuffer const &commandBuffer, TextureRegistry const &textureRegistry,
+                    vk::Extent2D const viewport, uint32_t const regionBase) const {
+        if (spriteCount == 0)
+            return;
+        auto const &slot{slots[currentSlot]};
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *drawPipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipelineLayout, 0,
+                                         {textureRegistry.GetDescriptorSet(), *slot.descriptorSet}, {});
+        commandBuffer.pushConstants<SpritePushConstants>(
+            *pipelineLayout, vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex, 0,
+            MakePushConstants(textureRegistry, viewport, regionBase));
+        commandBuffer.drawIndirect(slot.drawCommand.Get(), 0, 1, sizeof(vk::DrawIndirectCommand));
+    }
+
+private:
+    [[nodiscard]] SpritePushConstants MakePushConstants(TextureRegistry const &textureRegistry,
+                                                        vk::Extent2D const viewport, uint32_t const regionBase) const {
+        return SpritePushConstants{
+            {static_cast<float>(viewport.width), static_cast<float>(viewport.height)},
+            spriteBase,
+            spriteCount,
+            regionBase,
+            textureRegistry.GetHandleCount(),
+        };
+    }
+
+    void RecordCull(vk::raii::CommandBuffer const &commandBuffer, TextureRegistry const &textureRegistry,
+                    SpritePushConstants const &pushConstants) const {
+        auto const &slot{slots[currentSlot]};
+        // the slot's previous indirect draw has completed, only the reset has to land before the dispatch
+        commandBuffer.updateBuffer<vk::DrawIndirectCommand>(slot.drawCommand.Get(), 0,
+                                                            vk::DrawIndirectCommand{4, 0, 0, 0});
+        vk::MemoryBarrier2 const resetBarrier{
+            vk::PipelineStageFlagBits2::eAllTransfer,
+            vk::AccessFlagBits2::eTransferWrite,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+        };
+        vk::DependencyInfo resetDependency{};
+        resetDependency.setMemoryBarriers(resetBarrier);
+        commandBuffer.pipelineBarrier2(resetDependency);
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *cullPipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *pipelineLayout, 0,
+                                         {textureRegistry.GetDescriptorSet(), *slot.descriptorSet}, {});
+        commandBuffer.pushConstants<SpritePushConstants>(
+            *pipelineLayout, vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex, 0, pushConstants);
+        commandBuffer.dispatch((pushConstants.spriteCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+        vk::MemoryBarrier2 const cullBarrier{
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageWrite,
+            vk::PipelineStageFlagBits2::eDrawIndirect | vk::PipelineStageFlagBits2::eVertexShader,
+            vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eShaderStorageRead,
+        };
+        vk::DependencyInfo cullDependency{};
+        cullDependency.setMemoryBarriers(cullBarrier);
+        commandBuffer.pipelineBarrier2(cullDependency);
+    }
+
+    SlotBuffers CreateSlotBuffers(Allocator &allocator, TransientBuffer const &transientBuffer) const {
+        SlotBuffers slot{};
+
+        vk::BufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.size = static_cast<vk::DeviceSize>(capacity) * sizeof(uint32_t);
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+        VmaAllocationCreateInfo deviceAllocationCreateInfo{};
+        deviceAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        slot.visibleSprites = allocator.CreateBuffer(bufferCreateInfo, deviceAllocationCreateInfo,
+                                                     AllocationCategory::Dynamic);
+
+        bufferCreateInfo.size = sizeof(vk::DrawIndirectCommand);
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+            vk::BufferUsageFlagBits::eTransferDst;
+        slot.drawCommand = allocator.CreateBuffer(bufferCreateInfo, deviceAllocationCreateInfo,
+                                                  AllocationCategory::Dynamic);
+
+        vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+        descriptorSetAllocateInfo.descriptorPool = *descriptorPool;
+        descriptorSetAllocateInfo.setSetLayouts(*descriptorSetLayout);
+        slot.descriptorSet = std::move(device.allocateDescriptorSets(descriptorSetAllocateInfo).front());
+
+        std::array const bufferInfos{
+            vk::DescriptorBufferInfo{transientBuffer.GetBuffer(), 0, vk::WholeSize},
+            vk::DescriptorBufferInfo{slot.visibleSprites.Get(), 0, vk::WholeSize},
+            vk::DescriptorBufferInfo{slot.drawCommand.Get(), 0, vk::WholeSize},
+        };
+        std::array<vk::WriteDescriptorSet, bufferInfos.size()> writes{};
+        for (uint32_t binding = 0; binding < writes.size(); binding++) {
+            writes[binding].dstSet = *slot.descriptorSet;
+            writes[binding].dstBinding = binding;
+            writes[binding].descriptorType = vk::DescriptorType::eStorageBuffer;
+            writes[binding].setBufferInfo(bufferInfos[binding]);
+        }
+        device.updateDescriptorSets(writes, {});
+        return slot;
+    }
+
+    void InitCullPipeline(PersistentPipelineCache const &pipelineCache) {
+        auto const shaderModule{LoadShaderModule(device, SHADERS_PATH "sprite_cull.comp.spv")};
+        vk::ComputePipelineCreateInfo pipelineCreateInfo{};
+        pipelineCreateInfo.stage = vk::PipelineShaderStageCreateInfo{
+            {}, vk::ShaderStageFlagBits::eCompute, *shaderModule, "main"
+        };
+        pipelineCreateInfo.layout = *pipelineLayout;
+        cullPipeline = vk::raii::Pipeline{device, pipelineCache.Get(), pipelineCreateInfo};
+    }
+
+    void InitDrawPipeline(PersistentPipelineCache const &pipelineCache, vk::Format const colorFormat) {
+        auto const vertexShaderModule{LoadShaderModule(device, SHADERS_PATH "sprite.vert.spv")};
+        auto const fragmentShaderModule{LoadShaderModule(device, SHADERS_PATH "sprite.frag.spv")};
+        std::array const shaderStages{
+            vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eVertex, *vertexShaderModule, "main"},
+            vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eFragment, *fragmentShaderModule, "main"},
+        };
+
+        vk::PipelineVertexInputStateCreateInfo const vertexInputState{};
+        vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState{};
+        inputAssemblyState.topology = vk::PrimitiveTopology::eTriangleStrip;
+        vk::PipelineViewportStateCreateInfo viewportState{};
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+        vk::PipelineRasterizationStateCreateInfo rasterizationState{};
+        rasterizationState.polygonMode = vk::PolygonMode::eFill;
+        rasterizationState.cullMode = vk::CullModeFlagBits::eNone;
+        rasterizationState.lineWidth = 1.0f;
+        vk::PipelineMultisampleStateCreateInfo multisampleState{};
+        multisampleState.rasterizationSamples = vk::SampleCountFlagBits::e1;
+        // straight alpha over whatever was drawn before, in submission order
+        vk::PipelineColorBlendAttachmentState colorBlendAttachment{};
+        colorBlendAttachment.blendEnable = true;
+        colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+        colorBlendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        colorBlendAttachment.colorBlendOp = vk::BlendOp::eAdd;
+        colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+        colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        colorBlendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
+        colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        vk::PipelineColorBlendStateCreateInfo colorBlendState{};
+        colorBlendState.setAttachments(colorBlendAttachment);
+        std::array const dynamicStates{vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+        vk::PipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.setDynamicStates(dynamicStates);
+
+        vk::GraphicsPipelineCreateInfo pipelineCreateInfo{};
+        pipelineCreateInfo.setStages(shaderStages);
+        pipelineCreateInfo.pVertexInputState = &vertexInputState;
+        pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+        pipelineCreateInfo.pViewportState = &viewportState;
+        pipelineCreateInfo.pRasterizationState = &rasterizationState;
+        pipelineCreateInfo.pMultisampleState = &multisampleState;
+        pipelineCreateInfo.pColorBlendState = &colorBlendState;
+        pipelineCreateInfo.pDynamicState = &dynamicState;
+        pipelineCreateInfo.layout = *pipelineLayout;
+
+        vk::PipelineRenderingCreateInfo renderingCreateInfo{};
+        renderingCreateInfo.setColorAttachmentFormats(colorFormat);
+
+        vk::StructureChain chain{pipelineCreateInfo, renderingCreateInfo};
+        drawPipeline = vk::raii::Pipeline{device, pipelineCache.Get(), chain.get<vk::GraphicsPipelineCreateInfo>()};
+    }
+};
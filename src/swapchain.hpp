@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+// How the swapchain trades latency for throughput
+enum class PresentProfile {
+    // Mailbox, else immediate, with an extra image so rendering never waits for the display
+    Throughput,
+    // FIFO with the fewest images the surface allows, so little more than one frame queues up behind the display
+    LowLatency,
+};
+
+// Owns the window swapchain and its image views. Resizes and suboptimal or out of date results only mark it stale, it
+// is recreated at most once per frame right before the next acquire. The old swapchain is handed to the new one as
+// oldSwapchain and kept alive until the frames that used its images have completed, so nothing waits for the device.
+class SwapchainManager {
+    struct RetiredSwapchain {
+        vk::raii::SwapchainKHR swapchain;
+        std::vector<vk::raii::ImageView> imageViews;
+        // Frame timeline value of the last submission that used its images
+        uint64_t retireValue{};
+    };
+
+    vk::raii::PhysicalDevice const &physicalDevice;
+    vk::raii::Device const &device;
+    vk::raii::SurfaceKHR const &surface;
+    vk::Format format;
+    PresentProfile profile;
+    // On top of rendering and blitting into the images
+    vk::ImageUsageFlags extraUsage;
+
+    std::optional<vk::raii::SwapchainKHR> swapchain{};
+    std::vector<vk::Image> images{};
+    std::vector<vk::raii::ImageView> imageViews{};
+    vk::Extent2D extent{};
+    vk::PresentModeKHR presentMode{};
+    bool stale{true};
+    std::deque<RetiredSwapchain> retired{};
+
+public:
+    // extraUsage has to be in the surface's supported usage flags
+    SwapchainManager(vk::raii::PhysicalDevice const &physicalDevice, vk::raii::Device const &device,
+                     vk::raii::SurfaceKHR const &surface, vk::Format const format, PresentProfile const profile,
+                     vk::ImageUsageFlags const extraUsage = {})
+        : physicalDevice{physicalDevice}, device{device}, surface{surface}, format{format}, profile{profile},
+          extraUsage{extraUsage} {}
+
+    SwapchainManager(SwapchainManager const &) = delete;
+    SwapchainManager &operator=(SwapchainManager const &) = delete;
+
+    // Cheap enough to call for every resize event, the work happens in the next Update
+    void Invalidate() { stale = true; }
+
+    // Recreates a stale swapchain, retiring the old one until the frame timeline reaches retireValue. windowExtent is
+    // used where the surface leaves the size to the swapchain. Returns false while the surface has no area, for
+    // example while the window is minimized.
+    bool Update(vk::Extent2D const windowExtent, uint64_t const retireValue) {
+        if (!stale)
+            return true;
+
+        auto const capabilities{physicalDevice.getSurfaceCapabilitiesKHR(*surface)};
+        auto newExtent{capabilities.currentExtent};
+        if (newExtent.width == UINT32_MAX)
+            newExtent = vk::Extent2D{
+                std::clamp(windowExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width),
+                std::clamp(windowExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height)
+            };
+        if (newExtent.width == 0 || newExtent.height == 0)
+            return false;
+
+        presentMode = ChoosePresentMode(physicalDevice.getSurfacePresentModesKHR(*surface));
+
+        vk::SwapchainCreateInfoKHR swapchainCreateInfo{};
+        swapchainCreateInfo.surface = *surface;
+        swapchainCreateInfo.minImageCount = ChooseImageCount(capabilities);
+        swapchainCreateInfo.imageFormat = format;
+        swapchainCreateInfo.imageColorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+        swapchainCreateInfo.imageExtent = newExtent;
+        swapchainCreateInfo.imageArrayLayers = 1;
+        swapchainCreateInfo.imageUsage = vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eTransferDst | extraUsage;
+        swapchainCreateInfo.preTransform = capabilities.currentTransform;
+        swapchainCreateInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
+        swapchainCreateInfo.presentMode = presentMode;
+        swapchainCreateInfo.clipped = true;
+        if (swapchain)
+            swapchainCreateInfo.oldSwapchain = **swapchain;
+
+        // created before the old one is moved out, emplacing directly would destroy the old handle first
+        vk::raii::SwapchainKHR newSwapchain{device, swapchainCreateInfo};
+        if (swapchain)
+            retired.push_back(RetiredSwapchain{std::move(*swapchain), std::exchange(imageViews, {}), retireValue});
+        swapchain.emplace(std::move(newSwapchain));
+        images = swapchain->getImages();
+        for (auto const &image: images)
+            imageViews.push_back(CreateImageView(image));
+
+        extent = newExtent;
+        stale = false;
+        return true;
+    }
+
+    // Destroys the retired swapchains whose last submission has completed
+    void CollectRetired(uint64_t const completedValue) {
+        while (!retired.empty() && retired.front().retireValue <= completedValue)
+            retired.pop_front();
+    }
+
+    // Returns the index of the acquired image, or nothing when the swapchain went out of date and has to be updated
+    std::optional<uint32_t> Acquire(vk::Semaphore const semaphore) {
+        try {
+            auto const [result, imageIndex] = swapchain->acquireNextImage(UINT64_MAX, semaphore, nullptr);
+            // a suboptimal image can still be presented, the swapchain is recreated before the next acquire
+            if (result == vk::Result::eSuboptimalKHR)
+                stale = true;
+            return imageIndex;
+        } catch (vk::OutOfDateKHRError const &) {
+            stale = true;
+            return std::nullopt;
+        }
+    }
+
+    void Present(vk::raii::Queue const &queue, uint32_t const imageIndex, vk::Semaphore const waitSemaphore) {
+        vk::PresentInfoKHR presentInfo{};
+        presentInfo.setSwapchains(**swapchain);
+        presentInfo.setImageIndices(imageIndex);
+        presentInfo.setWaitSemaphores(waitSemaphore);
+        try {
+            if (queue.presentKHR(presentInfo) == vk::Result::eSuboptimalKHR)
+                stale = true;
+        } catch (vk::OutOfDateKHRError const &) {
+            stale = true;
+        }
+    }
+
+    [[nodiscard]] vk::Extent2D GetExtent() const { return extent; }
+    [[nodiscard]] vk::PresentModeKHR GetPresentMode() const { return presentMode; }
+    [[nodiscard]] vk::Image GetImage(uint32_t const imageIndex) const { return images[imageIndex]; }
+    [[nodiscard]] vk::ImageView GetImageView(uint32_t const imageIndex) const { return *imageViews[imageIndex]; }
+
+private:
+    [[nodiscard]] vk::PresentModeKHR ChoosePresentMode(std::vector<vk::PresentModeKHR> const &supportedModes) const {
+        if (profile == PresentProfile::Throughput)
+            for (auto const mode: {vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate})
+                if (std::ranges::contains(supportedModes, mode))
+                    return mode;
+        // the only mode every surface supports
+        return vk::PresentModeKHR::eFifo;
+    }
+
+    [[nodiscard]] uint32_t ChooseImageCount(vk::SurfaceCapabilitiesKHR const &capabilities) const {
+        auto imageCount{
+            profile == PresentProfile::LowLatency
+                ? capabilities.minImageCount
+                : std::max(capabilities.minImageCount + 1, 3u)
+        };
+        // a maximum of zero means there is none
+        if (capabilities.maxImageCount != 0)
+            imageCount = std::min(imageCount, capabilities.maxImageCount);
+        return imageCount;
+    }
+
+    [[nodiscard]] vk::raii::ImageView CreateImageView(vk::Image const image) const {
+        vk::ImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.image = image;
+        imageViewCreateInfo.viewType = vk::ImageViewType::e2D;
+        imageViewCreateInfo.format = format;
+        imageViewCreateInfo.subresourceRange = vk::ImageSubresourceRange{
+            vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1
+        };
+        return vk::raii::ImageView{device, imageViewCreateInfo};
+    }
+};
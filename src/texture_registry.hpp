@@ -0,0 +1,764 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "memory.hpp"
+#include "render_graph.hpp"
+#include "texture_streamer.hpp"
+
+using TextureHandle = uint32_t;
+
+constexpr uint32_t MAX_TEXTURE_HANDLES{1 << 16};
+// Upper bound of the sampled image array, lowered to what the device allows
+constexpr uint32_t MAX_TEXTURE_DESCRIPTORS{4096};
+constexpr uint32_t INVALID_DESCRIPTOR_INDEX{UINT32_MAX};
+
+constexpr uint32_t ATLAS_PAGE_EXTENT{2048};
+// Packed rectangles start and end on multiples of ATLAS_ALIGNMENT, so the first ATLAS_PAGE_MIP_LEVELS levels of every
+// packed image cover whole texels of the page's levels
+constexpr uint32_t ATLAS_PAGE_MIP_LEVELS{5};
+constexpr uint32_t ATLAS_ALIGNMENT{1 << (ATLAS_PAGE_MIP_LEVELS - 1)};
+// Images up to this size in both dimensions share atlas pages, bigger ones get an image of their own
+constexpr uint32_t ATLAS_MAX_PACKED_EXTENT{256};
+
+// Where a handle's texels are, read by the shaders as a std430 array indexed by handle
+struct TextureRegion {
+    float uvOffset[2]{};
+    float uvScale[2]{};
+    uint32_t descriptorIndex{INVALID_DESCRIPTOR_INDEX};
+    // Highest level with valid texels, packed images only own the first few levels of their page
+    float maxLod{};
+};
+static_assert(sizeof(TextureRegion) == 24);
+
+// New texels for part of a resident texture, level 0 rectangles in texture coordinates whose texels are packed in the
+// staging buffer. The other levels are regenerated from level 0 where they overlap the rectangles.
+struct TexturePatch {
+    AllocatedBuffer staging{};
+    std::vector<vk::BufferImageCopy> regions{};
+    // Union of the regions
+    vk::Rect2D bounds{};
+};
+
+// Bindless registry of every texture the app draws. Handles are stable integers indexing a region array, the region
+// names an entry of one large UPDATE_AFTER_BIND sampled image array, so any number of textures is drawn with a single
+// descriptor set bound once and new textures never touch the sets of frames in flight. Small uncompressed images are
+// copied into shared atlas pages on the graphics queue, everything else keeps the image the streamer created.
+class TextureRegistry {
+    struct AtlasShelf {
+        uint32_t y{};
+        uint32_t height{};
+        uint32_t nextX{};
+    };
+
+    struct AtlasPage {
+        vk::Format format{};
+        AllocatedImage image{};
+        vk::raii::ImageView view{nullptr};
+        uint32_t descriptorIndex{};
+        std::vector<AtlasShelf> shelves{};
+        uint32_t nextShelfY{};
+        // Packed handles not yet retired, the shelves start over once it drops to zero
+        uint32_t liveCount{};
+        // Set once the page has been transitioned out of the undefined layout
+        bool initialized{};
+    };
+
+    struct Entry {
+        std::optional<uint32_t> page{};
+        // Where the texels start in the page, zero for dedicated textures
+        vk::Offset2D offset{};
+        vk::Extent2D extent{};
+        // Levels holding the texture's mip chain, the page's or the image's
+        uint32_t levelCount{};
+        // Whether the format allows the linear blits that regenerate the mip chain of a patched rectangle
+        bool patchable{};
+        // Dedicated textures only
+        AllocatedImage image{};
+        vk::raii::ImageView view{nullptr};
+        uint32_t descriptorIndex{INVALID_DESCRIPTOR_INDEX};
+    };
+
+    // Copy of a streamed image into its page, recorded by the next upload pass
+    struct AtlasCopy {
+        uint32_t page{};
+        AllocatedImage source{};
+        vk::Extent2D extent{};
+        vk::Offset2D offset{};
+        uint32_t sourceMipLevels{};
+        uint32_t levelCount{};
+    };
+
+    // What the upload pass records for an AtlasCopy, once the source image has been retired
+    struct RecordedCopy {
+        vk::Image source{};
+        uint32_t sourceMipLevels{};
+        vk::Image destination{};
+        vk::Extent2D extent{};
+        vk::Offset2D offset{};
+        uint32_t levelCount{};
+    };
+
+    struct PendingPatch {
+        TextureHandle handle{};
+        TexturePatch patch{};
+    };
+
+    // What the upload pass records for a PendingPatch, only the regions are offset into the image already
+    struct RecordedPatch {
+        vk::Buffer staging{};
+        std::span<vk::BufferImageCopy const> regions{};
+        vk::Image image{};
+        vk::Offset2D offset{};
+        vk::Extent2D extent{};
+        uint32_t levelCount{};
+        vk::Rect2D bounds{};
+        // An earlier copy or patch of the same upload pass wrote the image
+        bool afterWrite{};
+    };
+
+    template<typename T>
+    struct Retired {
+        T value;
+        // Frame timeline value of the last submission that may use it
+        uint64_t retireValue{};
+    };
+
+    vk::raii::PhysicalDevice const &physicalDevice;
+    vk::raii::Device const &device;
+    Allocator &allocator;
+    ImageLayout sourceLayout;
+    uint32_t descriptorCapacity{};
+
+    vk::raii::Sampler sampler{nullptr};
+    vk::raii::DescriptorSetLayout descriptorSetLayout{nullptr};
+    vk::raii::DescriptorPool descriptorPool{nullptr};
+    vk::raii::DescriptorSet descriptorSet{nullptr};
+
+    // One copy of the regions per frame slot, rewritten when a slot comes back and the regions changed since
+    AllocatedBuffer regionBuffer{};
+    std::byte *regionData{};
+    std::vector<TextureRegion> regions{};
+    uint64_t regionsVersion{1};
+    std::vector<uint64_t> slotRegionsVersions{};
+
+    std::vector<Entry> entries{};
+    std::vector<TextureHandle> freeHandles{};
+    uint32_t nextDescriptorIndex{};
+    std::vector<uint32_t> freeDescriptorIndices{};
+    std::vector<AtlasPage> pages{};
+
+    std::vector<AtlasCopy> pendingCopies{};
+    std::vector<PendingPatch> pendingPatches{};
+    std::deque<Retired<TextureHandle>> retiredHandles{};
+    std::deque<Retired<AllocatedImage>> retiredImages{};
+    std::deque<Retired<AllocatedBuffer>> retiredBuffers{};
+    // Entries swapped out by Replace, their handles stay in use
+    std::deque<Retired<Entry>> retiredEntries{};
+
+public:
+    // sourceLayout is the layout the streamer hands textures over in
+    TextureRegistry(vk::raii::PhysicalDevice const &physicalDevice, vk::raii::Device const &device,
+                    Allocator &allocator, ImageLayout const &sourceLayout, uint32_t const frameSlotCount)
+        : physicalDevice{physicalDevice}, device{device}, allocator{allocator}, sourceLayout{sourceLayout},
+          slotRegionsVersions(frameSlotCount) {
+        auto const propertiesChain{
+            physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceVulkan12Properties>()
+        };
+        auto const &vulkan12Properties{propertiesChain.get<vk::PhysicalDeviceVulkan12Properties>()};
+        descriptorCapacity = std::min({
+            MAX_TEXTURE_DESCRIPTORS,
+            vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+            vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages,
+        });
+
+        vk::SamplerCreateInfo samplerCreateInfo{};
+        samplerCreateInfo.magFilter = vk::Filter::eLinear;
+        samplerCreateInfo.minFilter = vk::Filter::eLinear;
+        samplerCreateInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+        samplerCreateInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+        samplerCreateInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+        samplerCreateInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+        samplerCreateInfo.maxLod = vk::LodClampNone;
+        sampler = vk::raii::Sampler{device, samplerCreateInfo};
+
+        InitDescriptorSet();
+
+        vk::BufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.size = static_cast<vk::DeviceSize>(frameSlotCount) * MAX_TEXTURE_HANDLES *
+                                sizeof(TextureRegion);
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        regionBuffer = allocator.CreateBuffer(bufferCreateInfo, allocationCreateInfo, AllocationCategory::Dynamic);
+        regionData = static_cast<std::byte *>(regionBuffer.GetMappedData());
+
+        vk::DescriptorBufferInfo const bufferInfo{regionBuffer.Get(), 0, vk::WholeSize};
+        vk::WriteDescriptorSet write{};
+        write.dstSet = *descriptorSet;
+        write.dstBinding = 0;
+        write.descriptorType = vk::DescriptorType::eStorageBuffer;
+        write.setBufferInfo(bufferInfo);
+        device.updateDescriptorSets(write, {});
+    }
+
+    TextureRegistry(TextureRegistry const &) = delete;
+    TextureRegistry &operator=(TextureRegistry const &) = delete;
+
+    // A stable handle for a texture that is still on its way, it draws nothing until Insert makes it resident
+    TextureHandle Reserve() {
+        TextureHandle handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+        } else {
+            if (entries.size() == MAX_TEXTURE_HANDLES)
+                throw std::runtime_error("Out of texture handles");
+            handle = static_cast<TextureHandle>(entries.size());
+            entries.emplace_back();
+            regions.emplace_back();
+        }
+        return handle;
+    }
+
+    // Makes a streamed texture resident under handle. Packed textures are copied by the next AddUploadPass, which has
+    // to be part of the first frame drawing the handle, just like the texture's acquire barrier and timeline wait.
+    void Insert(TextureHandle const handle, StreamedTexture texture) {
+        auto &entry{entries[handle]};
+        auto const block{GetFormatBlock(texture.format)};
+        // compressed copies would have to end on block boundaries inside the page, so only plain texels are packed
+        if (block.extent.width == 1 && block.extent.height == 1 && texture.extent.width <= ATLAS_MAX_PACKED_EXTENT &&
+            texture.extent.height <= ATLAS_MAX_PACKED_EXTENT) {
+            auto const [pageIndex, offset]{PackIntoAtlas(texture.format, texture.extent)};
+            auto &page{pages[pageIndex]};
+            page.liveCount++;
+            auto const levelCount{std::min(texture.mipLevels, ATLAS_PAGE_MIP_LEVELS)};
+            entry.page = pageIndex;
+            entry.offset = offset;
+            entry.extent = texture.extent;
+            entry.levelCount = levelCount;
+            entry.patchable = CanBlitMipmaps(texture.format, levelCount);
+            regions[handle] = TextureRegion{
+                {
+                    static_cast<float>(offset.x) / ATLAS_PAGE_EXTENT,
+                    static_cast<float>(offset.y) / ATLAS_PAGE_EXTENT,
+                },
+                {
+                    static_cast<float>(texture.extent.width) / ATLAS_PAGE_EXTENT,
+                    static_cast<float>(texture.extent.height) / ATLAS_PAGE_EXTENT,
+                },
+                page.descriptorIndex,
+                static_cast<float>(levelCount - 1),
+            };
+            pendingCopies.push_back(AtlasCopy{
+                pageIndex, std::move(texture.image), texture.extent, offset, texture.mipLevels, levelCount
+            });
+        } else {
+            entry.extent = texture.extent;
+            entry.levelCount = texture.mipLevels;
+            entry.patchable = CanBlitMipmaps(texture.format, texture.mipLevels);
+            entry.image = std::move(texture.image);
+            entry.view = CreateImageView(entry.image.Get(), texture.format, texture.mipLevels);
+            entry.descriptorIndex = AllocateDescriptorIndex();
+            WriteDescriptor(entry.descriptorIndex, *entry.view);
+            regions[handle] = TextureRegion{
+                {0.0f, 0.0f}, {1.0f, 1.0f}, entry.descriptorIndex, static_cast<float>(texture.mipLevels - 1)
+            };
+        }
+        regionsVersion++;
+    }
+
+    // Swaps the texture of a resident handle for a new one, starting with the next recorded frame. Frames up to
+    // lastUseValue keep drawing the old texture, its memory and descriptor are reused once they have completed.
+    void Replace(TextureHandle const handle, StreamedTexture texture, uint64_t const lastUseValue) {
+        std::erase_if(pendingPatches, [handle](auto const &pendingPatch) { return pendingPatch.handle == handle; });
+        retiredEntries.push_back({std::move(entries[handle]), lastUseValue});
+        entries[handle] = Entry{};
+        Insert(handle, std::move(texture));
+    }
+
+    // Rewrites part of a texture in place, recorded by the next AddUploadPass. The handle has to have been drawn by an
+    // earlier frame already, those frames finish sampling before the pass writes and later ones see the whole patch.
+    // Only for handles IsPatchable reports, everything else has to be streamed again and replaced.
+    void Patch(TextureHandle const handle, TexturePatch patch) {
+        pendingPatches.push_back({handle, std::move(patch)});
+    }
+
+    // Stops drawing handle right away, its memory and descriptor are reused once the frame timeline passes
+    // lastUseValue
+    void Release(TextureHandle const handle, uint64_t const lastUseValue) {
+        std::erase_if(pendingPatches, [handle](auto const &pendingPatch) { return pendingPatch.handle == handle; });
+        regions[handle] = TextureRegion{};
+        regionsVersion++;
+        retiredHandles.push_back({handle, lastUseValue});
+    }
+
+    // Frees everything retired by frames up to completedValue
+    void CollectRetired(uint64_t const completedValue) {
+        while (!retiredImages.empty() && retiredImages.front().retireValue <= completedValue)
+            retiredImages.pop_front();
+        while (!retiredBuffers.empty() && retiredBuffers.front().retireValue <= completedValue)
+            retiredBuffers.pop_front();
+        while (!retiredEntries.empty() && retiredEntries.front().retireValue <= completedValue) {
+            ReleaseEntry(retiredEntries.front().value);
+            retiredEntries.pop_front();
+        }
+        while (!retiredHandles.empty() && retiredHandles.front().retireValue <= completedValue) {
+            FreeHandle(retiredHandles.front().value);
+            retiredHandles.pop_front();
+        }
+    }
+
+    // Adds a pass copying the textures inserted since the last call into their atlas pages and applying the patches
+    // since then, the streamed images and staging buffers are freed once the frame signaling frameValue has completed.
+    // Returns the accesses a later pass drawing the textures has to declare, so the images it samples are back in a
+    // shader readable layout. They live in the graph's arena.
+    std::pmr::vector<RenderGraph::ImageAccess> AddUploadPass(RenderGraph &renderGraph, uint64_t const frameValue) {
+        auto &arena{renderGraph.GetArena()};
+        std::pmr::vector<RenderGraph::ImageAccess> drawAccesses{&arena};
+        if (pendingCopies.empty() && pendingPatches.empty())
+            return drawAccesses;
+
+        std::pmr::vector<RenderGraph::ImageAccess> accesses{&arena};
+        std::pmr::vector<std::optional<RenderGraph::ImageHandle>> pageImages(pages.size(), &arena);
+        using DedicatedImage = std::pair<TextureHandle, RenderGraph::ImageHandle>;
+        std::pmr::vector<DedicatedImage> dedicatedImages{&arena};
+        // earlier frames sampled the images in their fragment shaders, those reads have to finish first
+        auto const importImage{
+            [&](vk::Image const image, bool const initialized, uint32_t const levelCount) {
+                auto const imageHandle{
+                    renderGraph.ImportImage(
+                        image,
+                        initialized
+                            ? ImageLayout{
+                                vk::ImageLayout::eShaderReadOnlyOptimal,
+                                vk::PipelineStageFlagBits2::eFragmentShader,
+                                vk::AccessFlagBits2::eNone,
+                            }
+                            : ImageLayout{
+                                vk::ImageLayout::eUndefined,
+                                vk::PipelineStageFlagBits2::eNone,
+                                vk::AccessFlagBits2::eNone,
+                            },
+                        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, levelCount, 0, 1})
+                };
+                accesses.push_back({imageHandle, ResourceUsage::TransferDst});
+                drawAccesses.push_back({imageHandle, ResourceUsage::SampledFragment});
+                return imageHandle;
+            }
+        };
+        auto const importPage{
+            [&](uint32_t const pageIndex) {
+                auto &page{pages[pageIndex]};
+                if (!pageImages[pageIndex]) {
+                    pageImages[pageIndex] = importImage(page.image.Get(), page.initialized, ATLAS_PAGE_MIP_LEVELS);
+                    page.initialized = true;
+                }
+            }
+        };
+
+        // outlive this call in the arena, the pass only captures spans of them
+        auto const copies{AllocateSpan<RecordedCopy>(arena, pendingCopies.size())};
+        for (size_t i = 0; i < pendingCopies.size(); i++) {
+            auto &copy{pendingCopies[i]};
+            importPage(copy.page);
+            std::construct_at(&copies[i], RecordedCopy{
+                                  copy.source.Get(), copy.sourceMipLevels, pages[copy.page].image.Get(), copy.extent,
+                                  copy.offset, copy.levelCount
+                              });
+            retiredImages.push_back({std::move(copy.source), frameValue});
+        }
+        pendingCopies.clear();
+
+        // images written so far in the pass, a patch of one of them has to wait for those writes
+        std::pmr::vector<vk::Image> writtenImages{&arena};
+        for (auto const &copy: copies)
+            if (!std::ranges::contains(writtenImages, copy.destination))
+                writtenImages.push_back(copy.destination);
+
+        auto const patches{AllocateSpan<RecordedPatch>(arena, pendingPatches.size())};
+        for (size_t i = 0; i < pendingPatches.size(); i++) {
+            auto &[handle, patch]{pendingPatches[i]};
+            auto const &entry{entries[handle]};
+            vk::Image image;
+            if (entry.page) {
+                importPage(*entry.page);
+                image = pages[*entry.page].image.Get();
+            } else {
+                image = entry.image.Get();
+                // a dedicated image is imported once however many patches it gets
+                if (!std::ranges::contains(dedicatedImages, handle, &DedicatedImage::first))
+                    dedicatedImages.emplace_back(handle, importImage(image, true, entry.levelCount));
+            }
+            auto const regions{AllocateSpan<vk::BufferImageCopy>(arena, patch.regions.size())};
+            for (size_t j = 0; j < patch.regions.size(); j++) {
+                auto region{patch.regions[j]};
+                region.imageOffset.x += entry.offset.x;
+                region.imageOffset.y += entry.offset.y;
+                std::construct_at(&regions[j], region);
+            }
+            auto const afterWrite{std::ranges::contains(writtenImages, image)};
+            if (!afterWrite)
+                writtenImages.push_back(image);
+            std::construct_at(&patches[i], RecordedPatch{
+                                  patch.staging.Get(), regions, image, entry.offset, entry.extent, entry.levelCount,
+                                  patch.bounds, afterWrite
+                              });
+            retiredBuffers.push_back({std::move(patch.staging), frameValue});
+        }
+        pendingPatches.clear();
+
+        renderGraph.AddPass("texture upload", accesses,
+                            [this, copies, patches](vk::raii::CommandBuffer const &commandBuffer) {
+                                for (auto const &copy: copies)
+                                    RecordAtlasCopy(commandBuffer, copy);
+                                for (auto const &patch: patches)
+                                    RecordPatch(commandBuffer, patch);
+                            });
+        return drawAccesses;
+    }
+
+    [[nodiscard]] bool IsResident(TextureHandle const handle) const {
+        return entries[handle].page || entries[handle].image;
+    }
+
+    [[nodiscard]] bool IsPatchable(TextureHandle const handle) const {
+        return IsResident(handle) && entries[handle].patchable;
+    }
+
+    // Brings the frame slot's copy of the regions up to date and returns the index of its first region. The slot's
+    // previous submission has to have completed.
+    uint32_t UpdateRegions(uint32_t const frameSlot) {
+        auto const regionBase{frameSlot * MAX_TEXTURE_HANDLES};
+        if (slotRegionsVersions[frameSlot] == regionsVersion)
+            return regionBase;
+        slotRegionsVersions[frameSlot] = regionsVersion;
+        auto const offset{static_cast<vk::DeviceSize>(regionBase) * sizeof(TextureRegion)};
+        auto const size{regions.size() * sizeof(TextureRegion)};
+        if (size == 0)
+            return regionBase;
+        std::memcpy(regionData + offset, regions.data(), size);
+        regionBuffer.Flush(offset, size);
+        return regionBase;
+    }
+
+    // Handles below this count may be resident, drawing that many instances covers every texture
+    [[nodiscard]] uint32_t GetHandleCount() const { return static_cast<uint32_t>(entries.size()); }
+    [[nodiscard]] vk::raii::DescriptorSetLayout const &GetDescriptorSetLayout() const { return descriptorSetLayout; }
+    [[nodiscard]] vk::DescriptorSet GetDescriptorSet() const { return *descriptorSet; }
+
+private:
+    void InitDescriptorSet() {
+        // binding 0 holds the regions, 1 the textures and 2 the sampler shared by all of them
+        vk::Sampler const immutableSampler{*sampler};
+        std::array const bindings{
+            vk::DescriptorSetLayoutBinding{
+                0, vk::DescriptorType::eStorageBuffer, 1,
+                vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment |
+                vk::ShaderStageFlagBits::eCompute
+            },
+            vk::DescriptorSetLayoutBinding{
+                1, vk::DescriptorType::eSampledImage, descriptorCapacity, vk::ShaderStageFlagBits::eFragment
+            },
+            vk::DescriptorSetLayoutBinding{
+                2, vk::DescriptorType::eSampler, 1, vk::ShaderStageFlagBits::eFragment, &immutableSampler
+            },
+        };
+        // textures are written while frames using other array elements are in flight, unused elements stay empty
+        std::array<vk::DescriptorBindingFlags, bindings.size()> const bindingFlags{
+            vk::DescriptorBindingFlags{},
+            vk::DescriptorBindingFlagBits::eUpdateAfterBind | vk::DescriptorBindingFlagBits::ePartiallyBound,
+            vk::DescriptorBindingFlags{},
+        };
+        vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo{};
+        descriptorSetLayoutCreateInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+        descriptorSetLayoutCreateInfo.setBindings(bindings);
+        vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{};
+        bindingFlagsCreateInfo.setBindingFlags(bindingFlags);
+        vk::StructureChain layoutChain{descriptorSetLayoutCreateInfo, bindingFlagsCreateInfo};
+        descriptorSetLayout = vk::raii::DescriptorSetLayout{
+            device, layoutChain.get<vk::DescriptorSetLayoutCreateInfo>()
+        };
+
+        // vk::raii::DescriptorSet frees itself, which needs eFreeDescriptorSet
+        std::array const poolSizes{
+            vk::DescriptorPoolSize{vk::DescriptorType::eStorageBuffer, 1},
+            vk::DescriptorPoolSize{vk::DescriptorType::eSampledImage, descriptorCapacity},
+            vk::DescriptorPoolSize{vk::DescriptorType::eSampler, 1},
+        };
+        vk::DescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+        descriptorPoolCreateInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet |
+            vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+        descriptorPoolCreateInfo.maxSets = 1;
+        descriptorPoolCreateInfo.setPoolSizes(poolSizes);
+        descriptorPool = vk::raii::DescriptorPool{device, descriptorPoolCreateInfo};
+
+        vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo{};
+        descriptorSetAllocateInfo.descriptorPool = *descriptorPool;
+        descriptorSetAllocateInfo.setSetLayouts(*descriptorSetLayout);
+        descriptorSet = std::move(device.allocateDescriptorSets(descriptorSetAllocateInfo).front());
+    }
+
+    uint32_t AllocateDescriptorIndex() {
+        if (!freeDescriptorIndices.empty()) {
+            auto const index{freeDescriptorIndices.back()};
+            freeDescriptorIndices.pop_back();
+            return index;
+        }
+        if (nextDescriptorIndex == descriptorCapacity)
+            throw std::runtime_error("Out of texture descriptors");
+        return nextDescriptorIndex++;
+    }
+
+    void WriteDescriptor(uint32_t const index, vk::ImageView const view) const {
+        vk::DescriptorImageInfo const imageInfo{{}, view, vk::ImageLayout::eShaderReadOnlyOptimal};
+        vk::WriteDescriptorSet write{};
+        write.dstSet = *descriptorSet;
+        write.dstBinding = 1;
+        write.dstArrayElement = index;
+        write.descriptorType = vk::DescriptorType::eSampledImage;
+        write.setImageInfo(imageInfo);
+        device.updateDescriptorSets(write, {});
+    }
+
+    [[nodiscard]] vk::raii::ImageView CreateImageView(vk::Image const image, vk::Format const format,
+                                                      uint32_t const mipLevels) const {
+        vk::ImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.image = image;
+        imageViewCreateInfo.viewType = vk::ImageViewType::e2D;
+        imageViewCreateInfo.format = format;
+        imageViewCreateInfo.subresourceRange = vk::ImageSubresourceRange{
+            vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1
+        };
+        return vk::raii::ImageView{device, imageViewCreateInfo};
+    }
+
+    template<typename T>
+    static std::span<T> AllocateSpan(std::pmr::memory_resource &arena, size_t const count) {
+        return {static_cast<T *>(arena.allocate(count * sizeof(T), alignof(T))), count};
+    }
+
+    // Gives back the atlas space or descriptor of an entry whose last frame has completed
+    void ReleaseEntry(Entry &entry) {
+        if (entry.page) {
+            // the page keeps its texels, its shelves are only reused once nothing is packed into it anymore
+            auto &page{pages[*entry.page]};
+            if (--page.liveCount == 0) {
+                page.shelves.clear();
+                page.nextShelfY = 0;
+            }
+        } else if (entry.descriptorIndex != INVALID_DESCRIPTOR_INDEX)
+            freeDescriptorIndices.push_back(entry.descriptorIndex);
+        entry = Entry{};
+    }
+
+    void FreeHandle(TextureHandle const handle) {
+        ReleaseEntry(entries[handle]);
+        freeHandles.push_back(handle);
+    }
+
+    // Shelf packing, rectangles go onto the lowest shelf that is tall enough, a new shelf is opened otherwise
+    static std::optional<vk::Offset2D> AllocateRect(AtlasPage &page, vk::Extent2D const extent) {
+        auto const width{(extent.width + ATLAS_ALIGNMENT - 1) / ATLAS_ALIGNMENT * ATLAS_ALIGNMENT};
+        auto const height{(extent.height + ATLAS_ALIGNMENT - 1) / ATLAS_ALIGNMENT * ATLAS_ALIGNMENT};
+        AtlasShelf *best{};
+        for (auto &shelf: page.shelves)
+            if (shelf.height >= height && ATLAS_PAGE_EXTENT - shelf.nextX >= width &&
+                (!best || shelf.height < best->height))
+                best = &shelf;
+        if (!best) {
+            if (ATLAS_PAGE_EXTENT - page.nextShelfY < height)
+                return std::nullopt;
+            best = &page.shelves.emplace_back(AtlasShelf{page.nextShelfY, height});
+            page.nextShelfY += height;
+        }
+        vk::Offset2D const offset{static_cast<int32_t>(best->nextX), static_cast<int32_t>(best->y)};
+        best->nextX += width;
+        return offset;
+    }
+
+    // A single level needs no blits at all
+    [[nodiscard]] bool CanBlitMipmaps(vk::Format const format, uint32_t const levelCount) const {
+        vk::FormatFeatureFlags const blitFeatures{
+            vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst |
+            vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+        };
+        return levelCount == 1 ||
+            (physicalDevice.getFormatProperties(format).optimalTilingFeatures & blitFeatures) == blitFeatures;
+    }
+
+    std::pair<uint32_t, vk::Offset2D> PackIntoAtlas(vk::Format const format, vk::Extent2D const extent) {
+        for (uint32_t i = 0; i < pages.size(); i++)
+            if (pages[i].format == format)
+                if (auto const offset{AllocateRect(pages[i], extent)})
+                    return {i, *offset};
+
+        vk::ImageCreateInfo imageCreateInfo{};
+        imageCreateInfo.imageType = vk::ImageType::e2D;
+        imageCreateInfo.format = format;
+        imageCreateInfo.extent = vk::Extent3D{ATLAS_PAGE_EXTENT, ATLAS_PAGE_EXTENT, 1};
+        imageCreateInfo.mipLevels = ATLAS_PAGE_MIP_LEVELS;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+        imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+        // patches blit the mip levels of their rectangle from the page's own level above
+        imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eSampled;
+        imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        AtlasPage page{format};
+        page.image = allocator.CreateImage(imageCreateInfo, allocationCreateInfo, AllocationCategory::Texture);
+        page.view = CreateImageView(page.image.Get(), format, ATLAS_PAGE_MIP_LEVELS);
+        page.descriptorIndex = AllocateDescriptorIndex();
+        WriteDescriptor(page.descriptorIndex, *page.view);
+        auto const offset{AllocateRect(page, extent)};
+        pages.push_back(std::move(page));
+        return {static_cast<uint32_t>(pages.size() - 1), *offset};
+    }
+
+    // Streamed images are not tracked by the render graph. Their acquire barrier is in the graph's first batch, which
+    // does not order barriers against each other, so the transition to a copy source is chained after it from here.
+    void RecordAtlasCopy(vk::raii::CommandBuffer const &commandBuffer, RecordedCopy const &copy) const {
+        TransitionImageLayout(commandBuffer, copy.source,
+                              ImageLayout{sourceLayout.imageLayout, sourceLayout.stageMask, vk::AccessFlagBits2::eNone},
+                              ImageLayout{
+                                  vk::ImageLayout::eTransferSrcOptimal,
+                                  vk::PipelineStageFlagBits2::eCopy,
+                                  vk::AccessFlagBits2::eTransferRead,
+                              },
+                              vk::ImageSubresourceRange{
+                                  vk::ImageAspectFlagBits::eColor, 0, copy.sourceMipLevels, 0, 1
+                              });
+
+        std::array<vk::ImageCopy2, ATLAS_PAGE_MIP_LEVELS> copyRegions{};
+        for (uint32_t level = 0; level < copy.levelCount; level++) {
+            auto &region{copyRegions[level]};
+            region.srcSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level, 0, 1};
+            region.dstSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level, 0, 1};
+            region.dstOffset = vk::Offset3D{copy.offset.x >> level, copy.offset.y >> level, 0};
+            region.extent = vk::Extent3D{
+                std::max(copy.extent.width >> level, 1u), std::max(copy.extent.height >> level, 1u), 1
+            };
+        }
+        vk::CopyImageInfo2 copyImageInfo{};
+        copyImageInfo.srcImage = copy.source;
+        copyImageInfo.srcImageLayout = vk::ImageLayout::eTransferSrcOptimal;
+        copyImageInfo.dstImage = copy.destination;
+        copyImageInfo.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
+        copyImageInfo.regionCount = copy.levelCount;
+        copyImageInfo.pRegions = copyRegions.data();
+        commandBuffer.copyImage2(copyImageInfo);
+    }
+
+    // Copies the patch's regions into level 0, then blits each further level from the one above, but only where it is
+    // covered by the patched rectangle. Along an axis that does not halve exactly, the level was generated by a blit
+    // scaling the whole level, so it is blitted whole along that axis to get the same texels, and so are the levels
+    // below it.
+    static void RecordPatch(vk::raii::CommandBuffer const &commandBuffer, RecordedPatch const &patch) {
+        ImageLayout const blitSource{
+            vk::ImageLayout::eTransferSrcOptimal,
+            vk::PipelineStageFlagBits2::eBlit,
+            vk::AccessFlagBits2::eTransferRead,
+        };
+        ImageLayout const blitDestination{
+            vk::ImageLayout::eTransferDstOptimal,
+            vk::PipelineStageFlagBits2::eCopy | vk::PipelineStageFlagBits2::eBlit,
+            vk::AccessFlagBits2::eTransferWrite,
+        };
+
+        // copies and patches before this one may have written the same texels or levels, with overlapping regions
+        // or mip blits covering the same rectangle
+        if (patch.afterWrite)
+            TransitionImageLayout(commandBuffer, patch.image, blitDestination,
+                                  ImageLayout{
+                                      blitDestination.imageLayout, blitDestination.stageMask,
+                                      vk::AccessFlagBits2::eTransferRead | vk::AccessFlagBits2::eTransferWrite
+                                  },
+                                  vk::ImageSubresourceRange{
+                                      vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0, 1
+                                  });
+        commandBuffer.copyBufferToImage(patch.staging, patch.image, vk::ImageLayout::eTransferDstOptimal,
+                                        patch.regions);
+
+        // texel ranges of the current level, start and end per axis
+        std::array<uint32_t, 2> begin{
+            static_cast<uint32_t>(patch.bounds.offset.x), static_cast<uint32_t>(patch.bounds.offset.y)
+        };
+        std::array<uint32_t, 2> end{begin[0] + patch.bounds.extent.width, begin[1] + patch.bounds.extent.height};
+        std::array extent{patch.extent.width, patch.extent.height};
+        for (uint32_t level = 1; level < patch.levelCount; level++) {
+            TransitionImageLayout(commandBuffer, patch.image, blitDestination, blitSource,
+                                  vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, level - 1, 1, 0, 1});
+
+            std::array const nextExtent{std::max(extent[0] / 2, 1u), std::max(extent[1] / 2, 1u)};
+            std::array<uint32_t, 2> sourceBegin{}, sourceEnd{};
+            for (size_t axis = 0; axis < 2; axis++) {
+                if (extent[axis] == nextExtent[axis] * 2) {
+                    begin[axis] /= 2;
+                    end[axis] = (end[axis] + 1) / 2;
+                    sourceBegin[axis] = begin[axis] * 2;
+                    sourceEnd[axis] = end[axis] * 2;
+                } else {
+                    begin[axis] = 0;
+                    end[axis] = nextExtent[axis];
+                    sourceEnd[axis] = extent[axis];
+                }
+            }
+
+            vk::ImageBlit2 region{};
+            region.srcSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level - 1, 0, 1};
+            region.srcOffsets[0] = vk::Offset3D{
+                (patch.offset.x >> (level - 1)) + static_cast<int32_t>(sourceBegin[0]),
+                (patch.offset.y >> (level - 1)) + static_cast<int32_t>(sourceBegin[1]), 0
+            };
+            region.srcOffsets[1] = vk::Offset3D{
+                (patch.offset.x >> (level - 1)) + static_cast<int32_t>(sourceEnd[0]),
+                (patch.offset.y >> (level - 1)) + static_cast<int32_t>(sourceEnd[1]), 1
+            };
+            region.dstSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level, 0, 1};
+            region.dstOffsets[0] = vk::Offset3D{
+                (patch.offset.x >> level) + static_cast<int32_t>(begin[0]),
+                (patch.offset.y >> level) + static_cast<int32_t>(begin[1]), 0
+            };
+            region.dstOffsets[1] = vk::Offset3D{
+                (patch.offset.x >> level) + static_cast<int32_t>(end[0]),
+                (patch.offset.y >> level) + static_cast<int32_t>(end[1]), 1
+            };
+            vk::BlitImageInfo2 blitImageInfo{};
+            blitImageInfo.srcImage = patch.image;
+            blitImageInfo.srcImageLayout = vk::ImageLayout::eTransferSrcOptimal;
+            blitImageInfo.dstImage = patch.image;
+            blitImageInfo.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
+            blitImageInfo.filter = vk::Filter::eLinear;
+            blitImageInfo.setRegions(region);
+            commandBuffer.blitImage2(blitImageInfo);
+            extent = nextExtent;
+        }
+
+        // the pass declared the whole image as a copy destination, the graph moves it on from there. Later copies and
+        // patches in the same pass write these levels again, so they wait for the blits reading them.
+        if (patch.levelCount > 1)
+            TransitionImageLayout(commandBuffer, patch.image,
+                                  ImageLayout{blitSource.imageLayout, blitSource.stageMask, vk::AccessFlagBits2::eNone},
+                                  blitDestination,
+                                  vk::ImageSubresourceRange{
+                                      vk::ImageAspectFlagBits::eColor, 0, patch.levelCount - 1, 0, 1
+                                  });
+    }
+};
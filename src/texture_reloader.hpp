@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <SDL3/SDL.h>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "asset_watcher.hpp"
+#include "image_decoder.hpp"
+#include "memory.hpp"
+#include "texture_registry.hpp"
+
+// Edge of the square tiles changed images are compared in, a multiple of ATLAS_ALIGNMENT so patched rectangles stay
+// aligned down to the last level atlas pages hold
+constexpr uint32_t RELOAD_TILE_EXTENT{64};
+static_assert(RELOAD_TILE_EXTENT % ATLAS_ALIGNMENT == 0);
+// How long the worker waits for file changes before it checks for new files and whether it has to stop
+constexpr std::chrono::milliseconds RELOAD_POLL_INTERVAL{100};
+
+// A watched image whose file changed
+struct TextureChange {
+    TextureHandle handle{};
+    std::string filename{};
+    // Dirty tiles when only texels changed, empty when the image has to be streamed again as a whole
+    std::optional<TexturePatch> patch{};
+};
+
+// Hot reload of image files. A worker thread keeps the last decoded version of every watched file, and whenever an
+// AssetWatcher reports a file as rewritten it decodes the file again and compares the two tile by tile. Runs of dirty
+// tiles are converted into a staging buffer of their own, so the render thread only hands the patch to the registry.
+// Images that changed extent or format and KTX2 files, whose stored levels cannot be patched from level 0, come back
+// without a patch and are streamed again.
+class TextureReloader {
+    struct WatchRequest {
+        std::string filename{};
+        TextureHandle handle{};
+    };
+
+    struct WatchedTexture {
+        std::filesystem::path path{};
+        std::string filename{};
+        TextureHandle handle{};
+        // Last version the GPU copy was made from, absent when the file failed to decode
+        std::optional<DecodedImage> decoded{};
+    };
+
+    Allocator &allocator;
+
+    std::mutex mutex{};
+    std::vector<WatchRequest> watchRequests{};
+    std::vector<TextureChange> changes{};
+    // Declared last so it stops before anything it uses is destroyed
+    std::jthread worker{};
+
+public:
+    explicit TextureReloader(Allocator &allocator) : allocator{allocator} {
+        worker = std::jthread{[this](std::stop_token const &stopToken) { WatchLoop(stopToken); }};
+    }
+
+    TextureReloader(TextureReloader const &) = delete;
+    TextureReloader &operator=(TextureReloader const &) = delete;
+
+    // Reloads handle whenever filename changes, the file is decoded once right away to have something to compare with
+    void Watch(std::string filename, TextureHandle const handle) {
+        std::scoped_lock lock{mutex};
+        watchRequests.push_back({std::move(filename), handle});
+    }
+
+    // Changes found since the last call, in the order the files changed
+    std::vector<TextureChange> TakeChanges() {
+        std::scoped_lock lock{mutex};
+        return std::exchange(changes, {});
+    }
+
+private:
+    void WatchLoop(std::stop_token const &stopToken) {
+        AssetWatcher watcher{};
+        std::vector<WatchedTexture> textures{};
+        while (!stopToken.stop_requested()) {
+            std::vector<WatchRequest> requests;
+            {
+                std::scoped_lock lock{mutex};
+                requests = std::exchange(watchRequests, {});
+            }
+            for (auto &[filename, handle]: requests) {
+                auto path{std::filesystem::absolute(filename).lexically_normal()};
+                watcher.Watch(path);
+                auto decoded{ImageDecoder::Decode(filename)};
+                textures.push_back({std::move(path), std::move(filename), handle, std::move(decoded)});
+            }
+
+            for (auto const &path: watcher.Wait(RELOAD_POLL_INTERVAL))
+                for (auto &texture: textures)
+                    if (texture.path == path)
+                        Reload(texture);
+        }
+    }
+
+    void Reload(WatchedTexture &texture) {
+        // a file caught halfway through being written fails to decode, the event of the final write follows
+        auto decoded{ImageDecoder::Decode(texture.filename)};
+        if (!decoded)
+            return;
+
+        TextureChange change{texture.handle, texture.filename};
+        if (texture.decoded && CanPatch(*texture.decoded, *decoded)) {
+            change.patch = Diff(*texture.decoded, *decoded);
+            if (!change.patch) {
+                texture.decoded = std::move(decoded);
+                return;
+            }
+            std::println("Reloaded {}, {} dirty regions within {}x{} texels", texture.filename,
+                         change.patch->regions.size(), change.patch->bounds.extent.width,
+                         change.patch->bounds.extent.height);
+        } else
+            std::println("Reloaded {} as a whole", texture.filename);
+        texture.decoded = std::move(decoded);
+
+        std::scoped_lock lock{mutex};
+        changes.push_back(std::move(change));
+    }
+
+    // Only images decoded by SDL_image have a single level the rest of the chain is generated from, and the texture
+    // has to keep its extent and format
+    static bool CanPatch(DecodedImage const &previous, DecodedImage const &current) {
+        return previous.surface && current.surface && previous.surface->format == current.surface->format &&
+            previous.format == current.format && previous.conversion == current.conversion &&
+            previous.levels.front().extent == current.levels.front().extent &&
+            previous.mipLevels == current.mipLevels;
+    }
+
+    // Compares the decoded pixels tile by tile and stages every horizontal run of dirty tiles as one copy region.
+    // Returns nothing when no texel changed.
+    std::optional<TexturePatch> Diff(DecodedImage const &previous, DecodedImage const &current) const {
+        auto const extent{current.levels.front().extent};
+        auto const pixelSize{static_cast<size_t>(SDL_BYTESPERPIXEL(current.surface->format))};
+        auto const texelSize{static_cast<size_t>(GetFormatBlock(current.format).size)};
+        auto const previousPixels{previous.GetPixels()};
+        auto const currentPixels{current.GetPixels()};
+        auto const previousPitch{previous.levels.front().rowPitch};
+        auto const currentPitch{current.levels.front().rowPitch};
+
+        auto const tileColumns{(extent.width + RELOAD_TILE_EXTENT - 1) / RELOAD_TILE_EXTENT};
+        auto const tileRows{(extent.height + RELOAD_TILE_EXTENT - 1) / RELOAD_TILE_EXTENT};
+        auto const isDirty{
+            [&](uint32_t const column, uint32_t const row) {
+                auto const x{column * RELOAD_TILE_EXTENT};
+                auto const rowSize{std::min(RELOAD_TILE_EXTENT, extent.width - x) * pixelSize};
+                auto const yEnd{std::min((row + 1) * RELOAD_TILE_EXTENT, extent.height)};
+                for (auto y{row * RELOAD_TILE_EXTENT}; y < yEnd; y++)
+                    if (std::memcmp(previousPixels + y * previousPitch + x * pixelSize,
+                                    currentPixels + y * currentPitch + x * pixelSize, rowSize) != 0)
+                        return true;
+                return false;
+            }
+        };
+
+        // runs of dirty tiles as copies into level 0, their buffer offsets laid out back to back
+        TexturePatch patch{};
+        vk::DeviceSize stagingSize{};
+        for (uint32_t row = 0; row < tileRows; row++)
+            for (uint32_t column = 0; column < tileColumns;) {
+                if (!isDirty(column, row)) {
+                    column++;
+                    continue;
+                }
+                auto end{column + 1};
+                while (end < tileColumns && isDirty(end, row))
+                    end++;
+                vk::Offset2D const offset{
+                    static_cast<int32_t>(column * RELOAD_TILE_EXTENT), static_cast<int32_t>(row * RELOAD_TILE_EXTENT)
+                };
+                vk::Extent2D const regionExtent{
+                    std::min(end * RELOAD_TILE_EXTENT, extent.width) - column * RELOAD_TILE_EXTENT,
+                    std::min((row + 1) * RELOAD_TILE_EXTENT, extent.height) - row * RELOAD_TILE_EXTENT
+                };
+                patch.regions.push_back(vk::BufferImageCopy{
+                    stagingSize, 0, 0,
+                    vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                    vk::Offset3D{offset.x, offset.y, 0},
+                    vk::Extent3D{regionExtent.width, regionExtent.height, 1}
+                });
+                stagingSize += static_cast<vk::DeviceSize>(regionExtent.width) * regionExtent.height * texelSize;
+                // the tile ending the run was compared already and is clean
+                column = end + 1;
+            }
+        if (patch.regions.empty())
+            return std::nullopt;
+
+        vk::BufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.size = stagingSize;
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        patch.staging = allocator.CreateBuffer(bufferCreateInfo, allocationCreateInfo, AllocationCategory::Staging);
+        auto const stagingData{static_cast<std::byte *>(patch.staging.GetMappedData())};
+
+        int32_t left{INT32_MAX}, top{INT32_MAX}, right{}, bottom{};
+        for (auto const &region: patch.regions) {
+            auto const x{static_cast<size_t>(region.imageOffset.x)};
+            auto const rowSize{region.imageExtent.width * texelSize};
+            for (uint32_t y = 0; y < region.imageExtent.height; y++)
+                ConvertPixels(stagingData + region.bufferOffset + y * rowSize,
+                              currentPixels + (region.imageOffset.y + y) * currentPitch + x * pixelSize, rowSize,
+                              current.conversion);
+            left = std::min(left, region.imageOffset.x);
+            top = std::min(top, region.imageOffset.y);
+            right = std::max(right, region.imageOffset.x + static_cast<int32_t>(region.imageExtent.width));
+            bottom = std::max(bottom, region.imageOffset.y + static_cast<int32_t>(region.imageExtent.height));
+        }
+        patch.staging.Flush(0, stagingSize);
+        patch.bounds = vk::Rect2D{
+            {left, top}, {static_cast<uint32_t>(right - left), static_cast<uint32_t>(bottom - top)}
+        };
+        return patch;
+    }
+};
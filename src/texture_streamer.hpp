@@ -0,0 +1,589 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include <SDL3/SDL.h>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "image_layout.hpp"
+#include "memory.hpp"
+#include "image_decoder.hpp"
+
+// A fully uploaded texture handed over by TextureStreamer::TakeReady, the receiver owns the image
+struct StreamedTexture {
+    StreamTicket ticket{};
+    AllocatedImage image{};
+    vk::Extent2D extent{};
+    vk::Format format{};
+    uint32_t mipLevels{};
+    // Timeline and value the first graphics submission using the image has to wait for
+    vk::Semaphore readySemaphore{};
+    uint64_t readyValue{};
+    // Set when the transfer queue family released the image, the graphics queue family has to acquire it
+    bool needsAcquire{};
+};
+
+// Uploads the images an ImageDecoder produces on a transfer queue through a persistently mapped staging ring. Images
+// without a complete mip chain get the missing levels generated with blits on the graphics queue, block compressed
+// images are copied as they are. Everything happens in Pump(), which only records and submits what fits into the ring
+// and never waits on the GPU, so it can be called once per frame from the render loop.
+class TextureStreamer {
+    static constexpr vk::DeviceSize STAGING_ALIGNMENT{16};
+
+    struct Upload {
+        DecodedImage decoded;
+        AllocatedImage image{};
+        uint32_t level{};
+        // Next row of texel blocks of the current level
+        uint32_t nextRow{};
+    };
+
+    struct Submission {
+        vk::raii::CommandBuffer commandBuffer;
+        uint64_t timelineValue{};
+        // Staging ring head once a transfer submission has been recorded, everything before it is free when it completes
+        std::optional<uint64_t> stagingHead{};
+    };
+
+    // A queue the streamer submits to, with its own command pool and a timeline every submission signals
+    struct QueueTimeline {
+        vk::raii::Queue const &queue;
+        uint32_t familyIndex{};
+        vk::raii::Semaphore timeline{nullptr};
+        uint64_t submittedValue{};
+        vk::raii::CommandPool commandPool{nullptr};
+        std::vector<vk::raii::CommandBuffer> freeCommandBuffers{};
+        std::deque<Submission> submissions{};
+    };
+
+    ImageDecoder &decoder;
+    vk::raii::PhysicalDevice const &physicalDevice;
+    vk::raii::Device const &device;
+    Allocator &allocator;
+    vk::Extent3D transferGranularity;
+    ImageLayout finalLayout;
+    // Copies run on the transfer queue, mip generation needs blits and runs on the graphics queue
+    QueueTimeline transfer;
+    QueueTimeline graphics;
+
+    AllocatedBuffer staging{};
+    std::byte *stagingData{};
+    vk::DeviceSize stagingCapacity;
+    vk::DeviceSize maxBytesPerPump;
+    // Monotonic byte counters, the ring position is the counter modulo stagingCapacity
+    uint64_t stagingHead{};
+    uint64_t stagingTail{};
+
+    std::deque<Upload> uploads{};
+    std::vector<StreamedTexture> ready{};
+
+public:
+    TextureStreamer(ImageDecoder &decoder, vk::raii::PhysicalDevice const &physicalDevice,
+                    vk::raii::Device const &device, Allocator &allocator,
+                    vk::raii::Queue const &graphicsQueue, uint32_t const graphicsQueueFamilyIndex,
+                    vk::raii::Queue const &transferQueue, uint32_t const transferQueueFamilyIndex,
+                    vk::Extent3D const transferGranularity, ImageLayout const &finalLayout,
+                    vk::DeviceSize const stagingCapacity = 32 << 20, vk::DeviceSize const maxBytesPerPump = 8 << 20)
+        : decoder{decoder}, physicalDevice{physicalDevice}, device{device}, allocator{allocator},
+          transferGranularity{transferGranularity}, finalLayout{finalLayout},
+          transfer{transferQueue, transferQueueFamilyIndex}, graphics{graphicsQueue, graphicsQueueFamilyIndex},
+          stagingCapacity{stagingCapacity}, maxBytesPerPump{maxBytesPerPump} {
+        InitQueueTimeline(transfer);
+        InitQueueTimeline(graphics);
+
+        vk::BufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.size = stagingCapacity;
+        bufferCreateInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        staging = allocator.CreateBuffer(bufferCreateInfo, allocationCreateInfo, AllocationCategory::Staging);
+        stagingData = static_cast<std::byte *>(staging.GetMappedData());
+    }
+
+    ~TextureStreamer() {
+        WaitIdle(transfer);
+        WaitIdle(graphics);
+    }
+
+    TextureStreamer(TextureStreamer const &) = delete;
+    TextureStreamer &operator=(TextureStreamer const &) = delete;
+
+    StreamTicket Request(std::string filename) {
+        return decoder.Request(std::move(filename));
+    }
+
+    // Retires completed transfers, then records and submits as much pending upload work as the staging ring allows
+    void Pump() {
+        Retire(transfer);
+        Retire(graphics);
+
+        for (auto &decoded: decoder.TakeDecoded())
+            if (CheckFormatSupport(decoded) && CheckStagingFit(decoded))
+                uploads.push_back(Upload{std::move(decoded)});
+
+        if (uploads.empty())
+            return;
+
+        auto commandBuffer{AcquireCommandBuffer(transfer)};
+        vk::CommandBufferBeginInfo beginInfo{};
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        commandBuffer.begin(beginInfo);
+
+        vk::DeviceSize recordedBytes{};
+        std::vector<Upload> completed{};
+        while (!uploads.empty() && recordedBytes < maxBytesPerPump) {
+            auto &upload{uploads.front()};
+            auto const bytes{RecordUpload(commandBuffer, upload, maxBytesPerPump - recordedBytes)};
+            if (bytes == 0)
+                break;
+            recordedBytes += bytes;
+            if (upload.level < upload.decoded.levels.size())
+                continue;
+            completed.push_back(std::move(upload));
+            uploads.pop_front();
+        }
+
+        commandBuffer.end();
+
+        if (recordedBytes == 0) {
+            commandBuffer.reset();
+            transfer.freeCommandBuffers.push_back(std::move(commandBuffer));
+            return;
+        }
+
+        auto const transferValue{Submit(transfer, std::move(commandBuffer), {}, stagingHead)};
+
+        std::vector<Upload *> incompleteMipChains{};
+        for (auto &upload: completed) {
+            if (upload.decoded.mipLevels > upload.decoded.levels.size())
+                incompleteMipChains.push_back(&upload);
+            else
+                ready.push_back(MakeStreamedTexture(upload, *transfer.timeline, transferValue,
+                                                    transfer.familyIndex != graphics.familyIndex));
+        }
+        if (!incompleteMipChains.empty())
+            GenerateMipmaps(incompleteMipChains, transferValue);
+    }
+
+    // Textures whose uploads have been submitted, ownership of the images moves to the caller
+    std::vector<StreamedTexture> TakeReady() {
+        return std::exchange(ready, {});
+    }
+
+    // Graphics queue family side of the ownership transfer for a texture with needsAcquire set
+    [[nodiscard]] vk::ImageMemoryBarrier2 GetAcquireBarrier(StreamedTexture const &texture) const {
+        return vk::ImageMemoryBarrier2{
+            vk::PipelineStageFlagBits2::eNone,
+            vk::AccessFlagBits2::eNone,
+            finalLayout.stageMask,
+            finalLayout.accessMask,
+            vk::ImageLayout::eTransferDstOptimal,
+            finalLayout.imageLayout,
+            transfer.familyIndex,
+            graphics.familyIndex,
+            texture.image.Get(), vk::ImageSubresourceRange{
+                vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0, 1
+            }
+        };
+    }
+
+    // Layout streamed textures are handed over in
+    [[nodiscard]] ImageLayout const &GetFinalLayout() const { return finalLayout; }
+
+private:
+    void InitQueueTimeline(QueueTimeline &queueTimeline) const {
+        vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> semaphoreCreateInfo{
+            {}, vk::SemaphoreTypeCreateInfo{vk::SemaphoreType::eTimeline, 0}
+        };
+        queueTimeline.timeline = vk::raii::Semaphore{device, semaphoreCreateInfo.get<vk::SemaphoreCreateInfo>()};
+
+        vk::CommandPoolCreateInfo commandPoolCreateInfo{};
+        commandPoolCreateInfo.queueFamilyIndex = queueTimeline.familyIndex;
+        commandPoolCreateInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer |
+            vk::CommandPoolCreateFlagBits::eTransient;
+        queueTimeline.commandPool = vk::raii::CommandPool{device, commandPoolCreateInfo};
+    }
+
+    void WaitIdle(QueueTimeline const &queueTimeline) const {
+        if (queueTimeline.submittedValue == 0)
+            return;
+        vk::SemaphoreWaitInfo waitInfo{};
+        waitInfo.setSemaphores(*queueTimeline.timeline);
+        waitInfo.setValues(queueTimeline.submittedValue);
+        auto _ = device.waitSemaphores(waitInfo, UINT64_MAX);
+    }
+
+    // Images have to be sampleable as stored, mip chains are only generated where the format supports linear blits
+    bool CheckFormatSupport(DecodedImage &decoded) const {
+        auto const features{physicalDevice.getFormatProperties(decoded.format).optimalTilingFeatures};
+        if (!(features & vk::FormatFeatureFlagBits::eSampledImage) ||
+            !(features & vk::FormatFeatureFlagBits::eTransferDst)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Image format %s is not supported by the device",
+                         vk::to_string(decoded.format).c_str());
+            return false;
+        }
+        vk::FormatFeatureFlags const blitFeatures{
+            vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst |
+            vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+        };
+        if ((features & blitFeatures) != blitFeatures)
+            decoded.mipLevels = static_cast<uint32_t>(decoded.levels.size());
+        return true;
+    }
+
+    // Queues with a coarse transfer granularity get whole levels or granularity aligned slabs, the last of which ends
+    // at the bottom edge of the level. For compressed formats the granularity is in texel blocks.
+    [[nodiscard]] uint32_t GetRowGranularity(uint32_t const levelRows, uint32_t const remainingRows) const {
+        if (transferGranularity.height == 0)
+            return levelRows;
+        if (transferGranularity.height > 1)
+            return std::min(transferGranularity.height, remainingRows);
+        return 1;
+    }
+
+    // Bytes per row of texel blocks and rows of texel blocks of a level
+    static std::pair<vk::DeviceSize, uint32_t> GetLevelRows(DecodedImage const &decoded, size_t const level) {
+        auto const extent{decoded.levels[level].extent};
+        auto const block{GetFormatBlock(decoded.format)};
+        return {
+            static_cast<vk::DeviceSize>((extent.width + block.extent.width - 1) / block.extent.width) * block.size,
+            (extent.height + block.extent.height - 1) / block.extent.height
+        };
+    }
+
+    // Every copy spans at least one granule, which has to fit into the staging ring at once. Images with a larger
+    // one, such as big levels on queues that only copy whole levels, are rejected instead of stalling the ring.
+    bool CheckStagingFit(DecodedImage const &decoded) const {
+        for (size_t level = 0; level < decoded.levels.size(); level++) {
+            auto const [rowSize, levelRows]{GetLevelRows(decoded, level)};
+            if (GetRowGranularity(levelRows, levelRows) * rowSize <= stagingCapacity)
+                continue;
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Image level %zu of %ux%u texels does not fit into the %llu byte staging ring", level,
+                         decoded.levels[level].extent.width, decoded.levels[level].extent.height,
+                         static_cast<unsigned long long>(stagingCapacity));
+            return false;
+        }
+        return true;
+    }
+
+    void Retire(QueueTimeline &queueTimeline) {
+        auto const completedValue{queueTimeline.timeline.getCounterValue()};
+        while (!queueTimeline.submissions.empty() &&
+               queueTimeline.submissions.front().timelineValue <= completedValue) {
+            auto &submission{queueTimeline.submissions.front()};
+            if (submission.stagingHead)
+                stagingTail = *submission.stagingHead;
+            submission.commandBuffer.reset();
+            queueTimeline.freeCommandBuffers.push_back(std::move(submission.commandBuffer));
+            queueTimeline.submissions.pop_front();
+        }
+    }
+
+    vk::raii::CommandBuffer AcquireCommandBuffer(QueueTimeline &queueTimeline) const {
+        if (queueTimeline.freeCommandBuffers.empty()) {
+            vk::CommandBufferAllocateInfo commandBufferAllocateInfo{};
+            commandBufferAllocateInfo.commandPool = *queueTimeline.commandPool;
+            commandBufferAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+            commandBufferAllocateInfo.commandBufferCount = 1;
+            return std::move(device.allocateCommandBuffers(commandBufferAllocateInfo).front());
+        }
+        auto commandBuffer{std::move(queueTimeline.freeCommandBuffers.back())};
+        queueTimeline.freeCommandBuffers.pop_back();
+        return commandBuffer;
+    }
+
+    // Submits a recorded command buffer that signals the next value of the queue's timeline and returns that value
+    static uint64_t Submit(QueueTimeline &queueTimeline, vk::raii::CommandBuffer commandBuffer,
+                           std::span<vk::SemaphoreSubmitInfo const> const waitSemaphoreInfos,
+                           std::optional<uint64_t> const stagingHead) {
+        auto const timelineValue{++queueTimeline.submittedValue};
+        vk::CommandBufferSubmitInfo const commandBufferSubmitInfo{*commandBuffer};
+        vk::SemaphoreSubmitInfo const signalSemaphoreInfo{
+            *queueTimeline.timeline, timelineValue, vk::PipelineStageFlagBits2::eAllCommands
+        };
+        vk::SubmitInfo2 submitInfo{};
+        submitInfo.waitSemaphoreInfoCount = static_cast<uint32_t>(waitSemaphoreInfos.size());
+        submitInfo.pWaitSemaphoreInfos = waitSemaphoreInfos.data();
+        submitInfo.setCommandBufferInfos(commandBufferSubmitInfo);
+        submitInfo.setSignalSemaphoreInfos(signalSemaphoreInfo);
+        queueTimeline.queue.submit2(submitInfo);
+
+        queueTimeline.submissions.push_back(Submission{std::move(commandBuffer), timelineValue, stagingHead});
+        return timelineValue;
+    }
+
+    static StreamedTexture MakeStreamedTexture(Upload &upload, vk::Semaphore const readySemaphore,
+                                               uint64_t const readyValue, bool const needsAcquire) {
+        return StreamedTexture{
+            upload.decoded.ticket,
+            std::move(upload.image),
+            upload.decoded.levels.front().extent,
+            upload.decoded.format,
+            upload.decoded.mipLevels,
+            readySemaphore,
+            readyValue,
+            needsAcquire,
+        };
+    }
+
+    // Fills in the missing mip levels by blitting each level into the next one, after the transfer submission that
+    // completed the uploads. The uploaded levels arrive in TransferSrcOptimal, released by the transfer queue family
+    // when it is a different one.
+    void GenerateMipmaps(std::span<Upload * const> const incompleteMipChains, uint64_t const transferValue) {
+        auto commandBuffer{AcquireCommandBuffer(graphics)};
+        vk::CommandBufferBeginInfo beginInfo{};
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        commandBuffer.begin(beginInfo);
+
+        auto const ownershipTransfer{transfer.familyIndex != graphics.familyIndex};
+        ImageLayout const blitSource{
+            vk::ImageLayout::eTransferSrcOptimal,
+            vk::PipelineStageFlagBits2::eBlit,
+            vk::AccessFlagBits2::eTransferRead,
+        };
+        ImageLayout const blitDestination{
+            vk::ImageLayout::eTransferDstOptimal,
+            vk::PipelineStageFlagBits2::eBlit,
+            vk::AccessFlagBits2::eTransferWrite,
+        };
+
+        for (auto const upload: incompleteMipChains) {
+            auto const &decoded{upload->decoded};
+            auto const uploadedLevels{static_cast<uint32_t>(decoded.levels.size())};
+            if (ownershipTransfer)
+                TransitionImageLayout(commandBuffer, upload->image.Get(),
+                                      ImageLayout{
+                                          vk::ImageLayout::eTransferDstOptimal,
+                                          vk::PipelineStageFlagBits2::eBlit,
+                                          vk::AccessFlagBits2::eNone,
+                                          transfer.familyIndex,
+                                      },
+                                      ImageLayout{
+                                          blitSource.imageLayout,
+                                          blitSource.stageMask,
+                                          blitSource.accessMask,
+                                          graphics.familyIndex,
+                                      },
+                                      vk::ImageSubresourceRange{
+                                          vk::ImageAspectFlagBits::eColor, 0, uploadedLevels, 0, 1
+                                      });
+            TransitionImageLayout(commandBuffer, upload->image.Get(),
+                                  ImageLayout{
+                                      vk::ImageLayout::eUndefined,
+                                      vk::PipelineStageFlagBits2::eNone,
+                                      vk::AccessFlagBits2::eNone,
+                                  },
+                                  blitDestination,
+                                  vk::ImageSubresourceRange{
+                                      vk::ImageAspectFlagBits::eColor, uploadedLevels,
+                                      decoded.mipLevels - uploadedLevels, 0, 1
+                                  });
+
+            auto extent{decoded.levels.back().extent};
+            for (auto level{uploadedLevels}; level < decoded.mipLevels; level++) {
+                vk::Extent2D const nextExtent{std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+                vk::ImageBlit2 region{};
+                region.srcSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level - 1, 0, 1};
+                region.srcOffsets[1] = vk::Offset3D{
+                    static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1
+                };
+                region.dstSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level, 0, 1};
+                region.dstOffsets[1] = vk::Offset3D{
+                    static_cast<int32_t>(nextExtent.width), static_cast<int32_t>(nextExtent.height), 1
+                };
+                vk::BlitImageInfo2 blitImageInfo{};
+                blitImageInfo.srcImage = upload->image.Get();
+                blitImageInfo.srcImageLayout = vk::ImageLayout::eTransferSrcOptimal;
+                blitImageInfo.dstImage = upload->image.Get();
+                blitImageInfo.dstImageLayout = vk::ImageLayout::eTransferDstOptimal;
+                blitImageInfo.filter = vk::Filter::eLinear;
+                blitImageInfo.setRegions(region);
+                commandBuffer.blitImage2(blitImageInfo);
+
+                // the level just written is the source of the next blit
+                TransitionImageLayout(commandBuffer, upload->image.Get(), blitDestination, blitSource,
+                                      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, level, 1, 0, 1});
+                extent = nextExtent;
+            }
+
+            TransitionImageLayout(commandBuffer, upload->image.Get(), blitSource, finalLayout,
+                                  vk::ImageSubresourceRange{
+                                      vk::ImageAspectFlagBits::eColor, 0, decoded.mipLevels, 0, 1
+                                  });
+        }
+
+        commandBuffer.end();
+
+        std::array const waitSemaphoreInfos{
+            vk::SemaphoreSubmitInfo{*transfer.timeline, transferValue, vk::PipelineStageFlagBits2::eBlit}
+        };
+        auto const graphicsValue{Submit(graphics, std::move(commandBuffer), waitSemaphoreInfos, std::nullopt)};
+        for (auto const upload: incompleteMipChains)
+            ready.push_back(MakeStreamedTexture(*upload, *graphics.timeline, graphicsValue, false));
+    }
+
+    // Reserves the largest contiguous staging span of at most size bytes, rounded down to a multiple of granularity and
+    // starting at a multiple of alignment. Returns its offset and shrinks size to what was reserved.
+    std::optional<vk::DeviceSize> ReserveStaging(vk::DeviceSize &size, vk::DeviceSize const granularity,
+                                                 vk::DeviceSize const alignment) {
+        // an empty ring starts over at its beginning, so any granule up to the capacity fits
+        if (stagingHead == stagingTail) {
+            stagingHead = (stagingHead + stagingCapacity - 1) / stagingCapacity * stagingCapacity;
+            stagingTail = stagingHead;
+        }
+        auto position{stagingHead % stagingCapacity};
+        // the padding up to an aligned position is skipped, or the rest of the ring when no aligned position is left
+        auto const padding{
+            std::min((position + alignment - 1) / alignment * alignment, stagingCapacity) - position
+        };
+        if (padding > stagingCapacity - (stagingHead - stagingTail))
+            return std::nullopt;
+        stagingHead += padding;
+        position = (position + padding) % stagingCapacity;
+
+        auto const free{stagingCapacity - (stagingHead - stagingTail)};
+        auto contiguous{std::min(free, stagingCapacity - position)};
+        // not even one granule fits before the end of the ring, skip the remainder and wrap around
+        if (contiguous < granularity && free - contiguous >= granularity) {
+            stagingHead += contiguous;
+            contiguous = free - contiguous;
+            position = 0;
+        }
+        size = std::min(size, contiguous) / granularity * granularity;
+        if (size == 0)
+            return std::nullopt;
+        stagingHead += (size + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+        return position;
+    }
+
+    void CreateImage(vk::raii::CommandBuffer const &commandBuffer, Upload &upload) {
+        auto const &decoded{upload.decoded};
+        auto const extent{decoded.levels.front().extent};
+        vk::ImageCreateInfo imageCreateInfo{};
+        imageCreateInfo.imageType = vk::ImageType::e2D;
+        imageCreateInfo.format = decoded.format;
+        imageCreateInfo.extent = vk::Extent3D{extent.width, extent.height, 1};
+        imageCreateInfo.mipLevels = decoded.mipLevels;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+        imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+        // sources of mip generation blits and of copies into atlas pages
+        imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eSampled;
+        imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+        VmaAllocationCreateInfo imageAllocationCreateInfo{};
+        imageAllocationCreateInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        upload.image = allocator.CreateImage(imageCreateInfo, imageAllocationCreateInfo, AllocationCategory::Texture);
+
+        TransitionImageLayout(commandBuffer, upload.image.Get(),
+                              ImageLayout{
+                                  vk::ImageLayout::eUndefined,
+                                  vk::PipelineStageFlagBits2::eNone,
+                                  vk::AccessFlagBits2::eNone,
+                              },
+                              ImageLayout{
+                                  vk::ImageLayout::eTransferDstOptimal,
+                                  vk::PipelineStageFlagBits2::eCopy,
+                                  vk::AccessFlagBits2::eTransferWrite,
+                              },
+                              vk::ImageSubresourceRange{
+                                  vk::ImageAspectFlagBits::eColor, 0, static_cast<uint32_t>(decoded.levels.size()),
+                                  0, 1
+                              });
+    }
+
+    // Copies the next rows of texel blocks of an upload that fit into the staging ring and the byte budget, never
+    // past the end of the current level. Returns the bytes recorded.
+    vk::DeviceSize RecordUpload(vk::raii::CommandBuffer const &commandBuffer, Upload &upload,
+                                vk::DeviceSize const budget) {
+        auto const &decoded{upload.decoded};
+        auto const &level{decoded.levels[upload.level]};
+        auto const block{GetFormatBlock(decoded.format)};
+        auto const [rowSize, levelRows]{GetLevelRows(decoded, upload.level)};
+        auto const remainingRows{levelRows - upload.nextRow};
+        // CheckStagingFit made sure every granule fits into the ring
+        vk::DeviceSize const rowGranularity{GetRowGranularity(levelRows, remainingRows)};
+
+        // always make progress by at least one granule, even past the budget, and only stop short of the bottom edge
+        // on a granule boundary
+        auto budgetRows{std::max(std::min<vk::DeviceSize>(budget / rowSize, remainingRows), rowGranularity)};
+        if (budgetRows < remainingRows)
+            budgetRows -= budgetRows % rowGranularity;
+        auto size{budgetRows * rowSize};
+        // buffer offsets of copies have to be multiples of the texel block size, which for formats such as R8G8B8 is not
+        // a power of two
+        auto const offset{ReserveStaging(size, rowGranularity * rowSize, std::lcm(STAGING_ALIGNMENT, block.size))};
+        if (!offset)
+            return 0;
+        // the ring may have shrunk the span, but only to whole granules
+        auto const rowCount{static_cast<uint32_t>(size / rowSize)};
+
+        if (!upload.image)
+            CreateImage(commandBuffer, upload);
+
+        // the only copy of the decoded pixels, converted on the way into the persistently mapped ring
+        auto const pixels{decoded.GetPixels() + level.offset};
+        for (uint32_t row = 0; row < rowCount; row++)
+            ConvertPixels(stagingData + *offset + row * rowSize,
+                          pixels + static_cast<size_t>(upload.nextRow + row) * level.rowPitch, rowSize,
+                          decoded.conversion);
+        staging.Flush(*offset, size);
+
+        auto const y{upload.nextRow * block.extent.height};
+        commandBuffer.copyBufferToImage(staging.Get(), upload.image.Get(), vk::ImageLayout::eTransferDstOptimal,
+                                        vk::BufferImageCopy{
+                                            *offset, 0, 0,
+                                            vk::ImageSubresourceLayers{
+                                                vk::ImageAspectFlagBits::eColor, upload.level, 0, 1
+                                            },
+                                            vk::Offset3D{0, static_cast<int32_t>(y), 0},
+                                            vk::Extent3D{
+                                                level.extent.width,
+                                                std::min(rowCount * block.extent.height, level.extent.height - y),
+                                                1
+                                            }
+                                        });
+        upload.nextRow += rowCount;
+        if (upload.nextRow == levelRows) {
+            upload.level++;
+            upload.nextRow = 0;
+        }
+
+        if (upload.level == decoded.levels.size()) {
+            // levels that are missing get blitted from the uploaded ones on the graphics queue, with a dedicated
+            // transfer family this is the release half of the ownership transfer
+            auto const generateMipmaps{decoded.mipLevels > decoded.levels.size()};
+            auto const ownershipTransfer{transfer.familyIndex != graphics.familyIndex};
+            auto const handedOver{ownershipTransfer || generateMipmaps};
+            TransitionImageLayout(commandBuffer, upload.image.Get(),
+                                  ImageLayout{
+                                      vk::ImageLayout::eTransferDstOptimal,
+                                      vk::PipelineStageFlagBits2::eCopy,
+                                      vk::AccessFlagBits2::eTransferWrite,
+                                      ownershipTransfer ? transfer.familyIndex : VK_QUEUE_FAMILY_IGNORED,
+                                  },
+                                  ImageLayout{
+                                      generateMipmaps ? vk::ImageLayout::eTransferSrcOptimal : finalLayout.imageLayout,
+                                      handedOver ? vk::PipelineStageFlagBits2::eNone : finalLayout.stageMask,
+                                      handedOver ? vk::AccessFlagBits2::eNone : finalLayout.accessMask,
+                                      ownershipTransfer ? graphics.familyIndex : VK_QUEUE_FAMILY_IGNORED,
+                                  },
+                                  vk::ImageSubresourceRange{
+                                      vk::ImageAspectFlagBits::eColor, 0, static_cast<uint32_t>(decoded.levels.size()),
+                                      0, 1
+                                  });
+        }
+
+        return size;
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Collects timed spans from any thread and writes them in Chrome's trace_event JSON format, which chrome://tracing,
+// Perfetto and Speedscope can open.
+class TraceRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct Event {
+        std::string name{};
+        uint32_t threadIndex{};
+        Clock::time_point start{};
+        Clock::time_point end{};
+    };
+
+    struct Thread {
+        std::thread::id id{};
+        std::string name{};
+    };
+
+    Clock::time_point const origin{Clock::now()};
+    mutable std::mutex mutex{};
+    std::vector<Event> events{};
+    std::vector<Thread> threads{};
+
+public:
+    [[nodiscard]] Clock::time_point GetOrigin() const { return origin; }
+
+    // Names the calling thread in the trace, threads that never call this show up as "thread N"
+    void SetThreadName(std::string name) {
+        std::scoped_lock lock{mutex};
+        threads[ThreadIndex()].name = std::move(name);
+    }
+
+    void Add(std::string name, Clock::time_point const start, Clock::time_point const end) {
+        std::scoped_lock lock{mutex};
+        events.push_back(Event{std::move(name), ThreadIndex(), start, end});
+    }
+
+    // Returns false when the file could not be written
+    bool Write(std::filesystem::path const &filename) const {
+        std::ofstream output{filename};
+        if (!output)
+            return false;
+
+        std::vector<std::string> entries{};
+        {
+            std::scoped_lock lock{mutex};
+            for (uint32_t i = 0; i < threads.size(); i++) {
+                auto const name{threads[i].name.empty() ? std::format("thread {}", i) : threads[i].name};
+                entries.push_back(std::format(
+                    R"({{"name": "thread_name", "ph": "M", "pid": 0, "tid": {}, "args": {{"name": "{}"}}}})",
+                    i, Escape(name)));
+            }
+            for (auto const &[name, threadIndex, start, end]: events)
+                entries.push_back(std::format(R"({{"name": "{}", "ph": "X", "pid": 0, "tid": {}, "ts": {}, "dur": {}}})",
+                                              Escape(name), threadIndex, Microseconds(start - origin),
+                                              Microseconds(end - start)));
+        }
+
+        std::println(output, R"({{"displayTimeUnit": "ms", "traceEvents": [)");
+        for (size_t i = 0; i < entries.size(); i++)
+            std::println(output, "  {}{}", entries[i], i + 1 == entries.size() ? "" : ",");
+        std::println(output, "]}}");
+        return static_cast<bool>(output);
+    }
+
+    // Escapes text for use inside a JSON string, such as names reported by drivers
+    static std::string Escape(std::string_view const text) {
+        std::string escaped{};
+        for (auto const c: text) {
+            if (static_cast<unsigned char>(c) < 0x20) {
+                escaped += std::format("\\u{:04x}", static_cast<unsigned char>(c));
+                continue;
+            }
+            if (c == '"' || c == '\\')
+                escaped.push_back('\\');
+            escaped.push_back(c);
+        }
+        return escaped;
+    }
+
+private:
+    // Callers hold the mutex
+    uint32_t ThreadIndex() {
+        auto const id{std::this_thread::get_id()};
+        for (uint32_t i = 0; i < threads.size(); i++)
+            if (threads[i].id == id)
+                return i;
+        threads.push_back(Thread{id});
+        return static_cast<uint32_t>(threads.size() - 1);
+    }
+
+    static double Microseconds(Clock::duration const duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+};
+
+// Records the span between construction and destruction, does nothing without a recorder
+class TraceScope {
+    TraceRecorder *recorder;
+    std::string name;
+    TraceRecorder::Clock::time_point start{TraceRecorder::Clock::now()};
+
+public:
+    TraceScope(TraceRecorder *recorder, std::string name) : recorder{recorder}, name{std::move(name)} {}
+
+    ~TraceScope() {
+        if (recorder)
+            recorder->Add(std::move(name), start, TraceRecorder::Clock::now());
+    }
+
+    TraceScope(TraceScope const &) = delete;
+    TraceScope &operator=(TraceScope const &) = delete;
+};